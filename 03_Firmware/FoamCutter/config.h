@@ -68,6 +68,18 @@
 #define FAN_MIN_RPM 0       // Min fan RPM. This value is equal to (1/256) duty cycle on the PWM.
 #endif
 
+// ==================================================================================================
+// Laser raster mode for engraving images. A G1 with a D word carries the power of the pixels along
+// the line, two hex digits per pixel (00...FF = 0...100% of S), e.g. G1X10.5F3000D00FF80C0. The D word
+// must be the last word of the line. The line runs as one block, the stepper sets the power of each
+// pixel by its step events, so a scan line runs at constant speed with one line of g-code per up to
+// (LINE_BUFFER_SIZE-20)/2 pixels. The pixels wait in a ring buffer of RASTER_BUFFER_SIZE bytes until
+// the stepper has executed their block. Comment to disable.
+#ifdef LASER_CUTTER
+#define LASER_RASTER
+#define RASTER_BUFFER_SIZE                512     // (bytes) Must hold the pixels of several lines
+#endif
+
 // ==================================================================================================
 // Define runtime command special characters. These characters are 'picked-off' directly from the
 // serial read data stream and are not passed to the grbl line execution parser. Select characters
@@ -80,6 +92,26 @@
 #define CMD_CYCLE_START       '~'
 #define CMD_RESET             0x18 // ctrl-x
 
+// Feed and tool power override characters. Extended ASCII codes, which are never in g-code programs.
+// The overrides scale the programmed feed rate and tool power in %. The feed override applies to the
+// blocks in the buffer at once, the tool power to the running block.
+#define CMD_FEED_OVR_RESET          0x90 // Restores the feed override to 100%
+#define CMD_FEED_OVR_COARSE_PLUS    0x91
+#define CMD_FEED_OVR_COARSE_MINUS   0x92
+#define CMD_FEED_OVR_FINE_PLUS      0x93
+#define CMD_FEED_OVR_FINE_MINUS     0x94
+#define CMD_TOOL_OVR_RESET          0x99 // Restores the tool power override to 100%
+#define CMD_TOOL_OVR_COARSE_PLUS    0x9A
+#define CMD_TOOL_OVR_COARSE_MINUS   0x9B
+
+#define FEED_OVERRIDE_MIN           10   // (%)
+#define FEED_OVERRIDE_MAX           200  // (%) Blocks follow only up to the axis max rates
+#define TOOL_OVERRIDE_MIN           10   // (%)
+#define TOOL_OVERRIDE_MAX           200  // (%) The tool power is limited to 100% of the pwm
+#define OVERRIDE_COARSE_INCREMENT   10   // (%)
+#define OVERRIDE_FINE_INCREMENT     1    // (%)
+#define OVERRIDE_ENCODER_INCREMENT  5    // (%) Per step of the rotary encoder while cutting from the sd card
+
 // ==================================================================================================
 // The temporal resolution of the acceleration management subsystem. Higher number give smoother
 // acceleration but may impact performance.
@@ -109,14 +141,6 @@
 // never reach its target. This parameter should always be greater than zero.
 #define MINIMUM_STEPS_PER_MINUTE          800 // (steps/min) - Integer value only
 
-// ==================================================================================================
-// Time delay increments performed during a dwell. The default value is set at 50ms, which provides
-// a maximum time delay of roughly 55 minutes, more than enough for most any application. Increasing
-// this delay will increase the maximum dwell time linearly, but also reduces the responsiveness of
-// run-time command executions, like status reports, since these are performed between each dwell
-// time step. Also, keep in mind that the Arduino delay timer is not very accurate for long delays.
-#define DWELL_TIME_STEP                   50 // Integer (1-255) (milliseconds)
-
 // ==================================================================================================
 // The homing cycle seek and feed rates will adjust so all axes independently move at the homing
 // seek and feed rates regardless of how many axes are in motion simultaneously. If disabled, rates
@@ -165,7 +189,88 @@
 // available RAM, like when re-compiling for a Teensy or Sanguino. Or decrease if the Arduino
 // begins to crash due to the lack of available RAM or if the CPU is having trouble keeping
 // up with planning new incoming motions as they are executed.
+// NOTE: A block takes 43 bytes with PLANNER_FIXED_POINT, 41 without, plus 4 with S_CURVE_ACCELERATION
+// and 3 with LASER_RASTER (see block_t in planner.h). The sizes keep the planner, segment and raster
+// buffers below the 2592 bytes of the 36 blocks of 72 bytes before: 52 x 43 + 352 = 2588 bytes for the
+// foam cutter, 36 x 46 + 400 + 512 = 2568 bytes for the laser. $P reports the RAM left for the stack.
+#ifdef FOAM_CUTTER
+#define BLOCK_BUFFER_SIZE 52
+#endif
+#ifdef LASER_CUTTER
 #define BLOCK_BUFFER_SIZE 36
+#endif
+
+// The step segment buffer between the trapezoid generator and the stepper interrupt. The main program
+// cuts the blocks into segments of a constant step rate, each at most one acceleration tick and
+// SEGMENT_MAX_TIME or one slower step event long, and the stepper interrupt only executes them. It
+// prepares SEGMENT_BUFFER_TIME ahead of the segment in execution, plus the segment that reaches it. A
+// feed hold or feed override takes the segments of the block in execution back and prepares them
+// again, only the segment in execution and the segments of the blocks before still run:
+// SEGMENT_BUFFER_TIME + 2 x SEGMENT_MAX_TIME at most, 3 acceleration ticks of the foam cutter. The
+// buffer time must cover the longest time the main program does not call protocol_execute_runtime(),
+// like a refresh of the display, or the steppers pause until the next segment is ready. $P reports the
+// longest gap and the pauses (underruns) to size it. SEGMENT_BUFFER_SIZE limits the segments of short blocks. A segment
+// takes 8 bytes (9 with ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING), plus 13 bytes (16 with LASER_RASTER) of
+// stepper block data.
+#define SEGMENT_BUFFER_SIZE 16
+#define SEGMENT_MAX_TIME 20 // (msec)
+#define SEGMENT_BUFFER_TIME 20 // (msec)
+
+// Adaptive multi-axis step smoothing (AMASS). The bresenham line tracer steps the minor axes only with
+// the step events of the major axis, which is coarse at the low step rates of a foam cut: a minor axis
+// steps on an uneven grid of step events and the wire stutters on shallow tapers. Below a step rate of
+// 8kHz the stepper interrupt runs 2, 4 or 8 times per step event (levels 1-3 below 8, 4 and 2kHz) and
+// the bresenham increments are scaled to it, so the minor axes step at their own rate. The level is
+// chosen per segment, the interrupt never runs faster than 16kHz for it and the step rates above 8kHz,
+// like fast travel moves, are not changed. Comment to disable.
+#define ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+
+// Measures the stepper interrupt with timer 1: the cycles from the compare match to the end of the
+// handler, at step rates with the prescaler 1. $P reports the shortest run of each bresenham kernel
+// (AXES_XY, AXES_ZU, AXES_ALL), the cost of a step event without segment change or nested interrupt.
+// The measurement itself adds to every interrupt. Uncomment to enable.
+//#define STEPPER_ISR_TIMING
+
+// Runs the planner kernels (junction speed, forward and reverse pass, trapezoids) with integer
+// arithmetic and an integer square root instead of float math. The junction speeds use unit vectors
+// with 14 fraction bits and match the float planner within 0.2% (and 0.25 mm/min), the entry speeds
+// of the passes within 1 mm/min (both round down), the acceleration and deceleration points within
+// 1 step event. $P reports the planner and junction time per block to compare both modes. Comment
+// to use float math.
+#define PLANNER_FIXED_POINT
+
+// Accelerates and decelerates with S-curve ramps instead of linear ramps. The acceleration rises and
+// falls smoothly (bounded jerk), which avoids the sudden force changes that bow a long hot wire. A ramp
+// takes the same time and distance as the linear ramp, the peak acceleration in the middle of the ramp
+// is 1.5 times the planned acceleration ($9, $35-$38). Comment to use linear ramps.
+//#define S_CURVE_ACCELERATION
+
+// Slows down short blocks while the planner buffer runs low. If less than half of the buffer is
+// filled and the blocks arriving are on average shorter than PLANNER_MIN_SEGMENT_TIME at their
+// nominal speed, the nominal speed of a new block is lowered just enough that the stepper does not
+// run the buffer dry and stop in the middle of a curve. The less blocks are buffered, the more a 
+// block is slowed down. $P reports how often the limiter kicked in. Comment to disable.
+#define PLANNER_SLOWDOWN
+#define PLANNER_MIN_SEGMENT_TIME 20000  // Min. time in usec a block takes while the buffer runs low
+
+// Merges consecutive, nearly collinear line segments in mc_line() into one planner block, as long
+// as all intermediate points stay within the line merge tolerance ($39) in both planes and both 
+// wire ends stay synchronized. Gcode with long runs of tiny segments gets a longer look-ahead and
+// less planner runs. Arc segments are not merged, their length already follows the arc tolerance
+// ($40). A tolerance of 0 disables the merging at runtime. Comment to disable.
+#define LINE_MERGE
+#define LINE_MERGE_MAX_POINTS 8   // Max. number of segments merged into one block (2-255)
+#define LINE_MERGE_TIMEOUT    20  // Max. time in msec a segment is held back for merging
+
+// Continuous path mode (G64 Pn). Rounds the corners between line segments with a short curve 
+// that stays within the path tolerance P in both planes, so the wire passes the corner without 
+// stopping. Both planes are cut at the same fraction of the segments and follow the curve with the
+// same parameter, so both wire ends stay synchronized. Corners the planner passes at the feed rate
+// anyway are not rounded. G61 (default) follows the exact path. Comment to treat G64 as G61.
+#define PATH_BLENDING
+#define PATH_BLEND_SEGMENTS          4     // Number of line segments per rounded corner
+#define PATH_BLEND_DEFAULT_TOLERANCE 0.05  // Path tolerance in mm of G64 without P
+#define PATH_BLEND_TIMEOUT           20    // Max. time in msec a segment is held back for blending
 
 
 // Line buffer size from the serial input stream to be executed. Also, governs the size of
@@ -52,6 +52,17 @@
   
   #define DEFAULT_ACCELERATION            25.0*60*60  // 10*60*60 mm/min^2 = 10 mm/s^2
   #define DEFAULT_JUNCTION_DEVIATION      0.05        // mm
+  // per axis limits, x/u are the horizontal belt axes, y/z the vertical axes
+  #define DEFAULT_X_MAX_RATE              DEFAULT_SEEKRATE      // mm/min
+  #define DEFAULT_Y_MAX_RATE              DEFAULT_SEEKRATE      // mm/min
+  #define DEFAULT_U_MAX_RATE              DEFAULT_SEEKRATE      // mm/min
+  #define DEFAULT_Z_MAX_RATE              DEFAULT_SEEKRATE      // mm/min
+  #define DEFAULT_X_ACCELERATION          DEFAULT_ACCELERATION  // mm/min^2
+  #define DEFAULT_Y_ACCELERATION          DEFAULT_ACCELERATION  // mm/min^2
+  #define DEFAULT_U_ACCELERATION          DEFAULT_ACCELERATION  // mm/min^2
+  #define DEFAULT_Z_ACCELERATION          DEFAULT_ACCELERATION  // mm/min^2
+  #define DEFAULT_LINE_MERGE_TOLERANCE    0.01        // mm
+  #define DEFAULT_ARC_TOLERANCE           0.01        // mm
 /// 8c1
   #define DEFAULT_STEPPING_INVERT_MASK    0           // b7=Z, b6=Y, b5=X, b0=U
   #define DEFAULT_REPORT_INCHES           0           // false
@@ -118,6 +129,13 @@
   
   #define DEFAULT_ACCELERATION            25.0*60*60  // 10*60*60 mm/min^2 = 10 mm/s^2
   #define DEFAULT_JUNCTION_DEVIATION      0.05        // mm
+  // per axis limits
+  #define DEFAULT_X_MAX_RATE              DEFAULT_SEEKRATE      // mm/min
+  #define DEFAULT_Y_MAX_RATE              DEFAULT_SEEKRATE      // mm/min
+  #define DEFAULT_X_ACCELERATION          DEFAULT_ACCELERATION  // mm/min^2
+  #define DEFAULT_Y_ACCELERATION          DEFAULT_ACCELERATION  // mm/min^2
+  #define DEFAULT_LINE_MERGE_TOLERANCE    0.01        // mm
+  #define DEFAULT_ARC_TOLERANCE           0.01        // mm
 /// 8c1
   #define DEFAULT_STEPPING_INVERT_MASK    64          // b7=Z, b6=Y, b5=X, b0=U
   #define DEFAULT_REPORT_INCHES           0           // false
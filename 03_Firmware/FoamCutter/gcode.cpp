@@ -68,6 +68,52 @@ static float to_millimeters(float value)
 {
   return(gc.inches_mode ? (value * MM_PER_INCH) : value);
 }
+// Computes the offsets from the current position to the center of an arc in radius format. x, y
+// is the travel along the plane axes, r the radius, negative for more than 180 degrees. Returns 
+// false, if no circle with this radius passes through both points. See the sketches in 
+// gc_execute_line().
+static uint8_t arc_offset_from_radius(float x, float y, float r, uint8_t isclockwise, float *offset_0, float *offset_1)
+{
+  // First, use h_x2_div_d to compute 4*h^2 to check if it is negative or r is smaller
+  // than d. If so, the sqrt of a negative number is complex and error out.
+  float h_x2_div_d = 4 * r*r - x*x - y*y;
+  if ((h_x2_div_d < 0) || ((x == 0) && (y == 0))) { return(false); }
+  // Finish computing h_x2_div_d.
+  h_x2_div_d = -sqrt(h_x2_div_d)/hypot(x,y); // == -(h * 2 / d)
+  // Invert the sign of h_x2_div_d if the circle is counter clockwise
+  if (!isclockwise) { h_x2_div_d = -h_x2_div_d; }
+  // Negative R places the center on the opposite side of the line of travel
+  if (r < 0) { h_x2_div_d = -h_x2_div_d; }
+  // Complete the operation by calculating the actual center of the arc
+  *offset_0 = 0.5*(x-(y*h_x2_div_d));
+  *offset_1 = 0.5*(y+(x*h_x2_div_d));
+  return(true);
+}
+
+#ifdef LASER_RASTER
+// Decodes the pixels of a raster line in place, two hex digits per pixel. Returns the number of pixels,
+// 0 if the data is empty, too long or not hex.
+static uint8_t raster_decode(char *hex)
+{
+  uint8_t *pixel = (uint8_t*)hex;
+  uint16_t count = 0;
+  while (hex[2*count] != 0) {
+    uint8_t value = 0;
+    uint8_t i;
+    for (i=0; i<2; i++) {
+      char c = hex[2*count+i];
+      value <<= 4;
+      if ((c >= '0') && (c <= '9')) { value |= c-'0'; }
+      else if ((c >= 'A') && (c <= 'F')) { value |= c-'A'+10; }
+      else { return(0); }                         // Not hex or odd number of digits
+    }
+    pixel[count++] = value;                       // Written behind the digits read
+    if (count > 255) { return(0); }
+  }
+  return(count);
+}
+#endif
+
 /// 8c1
 /// TODO ?
 float to_degrees(float value)
@@ -105,6 +151,20 @@ uint8_t gc_execute_line(char *line)
 
   gc.status_code = STATUS_OK;
 
+#ifdef LASER_RASTER
+  // Raster line: all characters behind the D word are the pixels. They are cut off before the parser
+  // passes and decoded in place.
+  uint8_t *raster = NULL;
+  uint8_t raster_count = 0;
+  char *raster_word = strchr(line, 'D');
+  if (raster_word != NULL) {
+    *raster_word = 0;
+    raster = (uint8_t*)raster_word+1;
+    raster_count = raster_decode(raster_word+1);
+    if (raster_count == 0) { return(STATUS_BAD_NUMBER_FORMAT); }
+  }
+#endif
+
   /* Pass 1: Commands and set all modes. Check for modal group violations.
      NOTE: Modal group numbers are defined in Table 4 of NIST RS274-NGC v3, pg.20 */
 
@@ -122,6 +182,7 @@ uint8_t gc_execute_line(char *line)
           case 93: case 94: group_number = MODAL_GROUP_5; break;
           case 20: case 21: group_number = MODAL_GROUP_6; break;
           case 54: case 55: case 56: case 57: case 58: case 59: group_number = MODAL_GROUP_12; break;
+          case 61: case 64: group_number = MODAL_GROUP_13; break;
         }
         // Set 'G' commands
         switch(int_value) {
@@ -150,6 +211,8 @@ uint8_t gc_execute_line(char *line)
           case 54: case 55: case 56: case 57: case 58: case 59:
             gc.coord_select = int_value-54;
             break;
+          case 61: gc.path_mode = PATH_MODE_EXACT; break;
+          case 64: gc.path_mode = PATH_MODE_BLEND; break;
           case 80: gc.motion_mode = MOTION_MODE_CANCEL; break;
           case 90: gc.absolute_mode = true; break;
           case 91: gc.absolute_mode = false; break;
@@ -205,11 +268,22 @@ uint8_t gc_execute_line(char *line)
      parameters are converted and flagged to indicate a change. These can have multiple connotations
      for different commands. Each will be converted to their proper value upon execution. */
   float p = 0, r = 0, s = 0;
+  float q = 0;                     // Radius of the UZ arc
+  uint8_t uz_arc = false;          // True, if the block has a center or radius of an UZ arc
+  float uz_offset[2] = {0, 0};     // Center offsets A (U) and B (Z) of the UZ arc, K keeps offset[Z_AXIS]
   uint8_t l = 0;
   char_counter = 0;
   while(next_statement(&letter, &value, line, &char_counter)) {
     switch(letter) {
       case 'G': case 'M': case 'N': break; // Ignore command statements and line numbers
+      case 'A':                        // Center offset of the UZ arc along U
+        uz_offset[0] = to_millimeters(value);
+        uz_arc = true;
+        break;
+      case 'B':                        // Center offset of the UZ arc along Z
+        uz_offset[1] = to_millimeters(value);
+        uz_arc = true;
+        break;
       case 'F':
         if (value <= 0)
           FAIL(STATUS_INVALID_STATEMENT);  // Must be greater than zero
@@ -228,6 +302,10 @@ uint8_t gc_execute_line(char *line)
       case 'P':
         p = value;
         break;
+      case 'Q':                        // Radius of the UZ arc
+        q = to_millimeters(value);
+        uz_arc = true;
+        break;
       case 'R':
         r = to_millimeters(value);
         break;
@@ -276,7 +354,12 @@ uint8_t gc_execute_line(char *line)
   if (gc.status_code)
     return gc.status_code;
 
-
+#ifdef LASER_RASTER
+  // The pixels of a raster line need a linear motion
+  if (raster_count && ((gc.motion_mode != MOTION_MODE_LINEAR) || !axis_words || non_modal_action)) {
+    return(STATUS_INVALID_STATEMENT);
+  }
+#endif
 
         
 
@@ -286,10 +369,8 @@ uint8_t gc_execute_line(char *line)
 
   // [M3,M4,M5]: Perform tool operations.
   if ( bit_istrue(modal_group_words,bit(MODAL_GROUP_7))) {
-    // Axis are not moved, so tools need to be operated manually
-    protocol_buffer_synchronize();
-    // [M3,M4,M5]: Update tool state
-    tool_run(gc.tool_state, gc.tool_pwr);
+    // Axis are not moved, so the tool change is queued as a dwell without time, see mc_tool()
+    mc_tool(gc.tool_state, gc.tool_pwr);
   }
 
 
@@ -301,6 +382,23 @@ uint8_t gc_execute_line(char *line)
     memcpy(gc.coord_system,coord_data,sizeof(coord_data));
   }
 
+  // [G61,G64]: Path control mode. G64 rounds the corners between line segments within the path 
+  // tolerance given by P, or PATH_BLEND_DEFAULT_TOLERANCE without P. G61 follows the exact path.
+  if ( bit_istrue(modal_group_words,bit(MODAL_GROUP_13)) ) { // Check if called in block
+    if (gc.path_mode == PATH_MODE_BLEND) {
+      if (p < 0) { // Tolerance cannot be negative.
+        FAIL(STATUS_INVALID_STATEMENT);
+      } else if (p > 0) {
+        gc.path_tolerance = to_millimeters(p);
+      } else {
+        gc.path_tolerance = PATH_BLEND_DEFAULT_TOLERANCE;
+      }
+      mc_set_path_tolerance(gc.path_tolerance);
+    } else {
+      mc_set_path_tolerance(0.0);
+    }
+  }
+
   // [G4,G10,G28,G30,G92,G92.1]: Perform dwell, set coordinate system data, homing, or set axis offsets.
   // NOTE: These commands are in the same modal group, hence are mutually exclusive. G53 is in this
   // modal group and do not effect these actions.
@@ -312,7 +410,7 @@ uint8_t gc_execute_line(char *line)
       else {
         // Ignore dwell in check gcode modes
         if (sys.state != STATE_CHECK_MODE)
-          mc_dwell(p);
+          mc_dwell(p, gc.tool_state, gc.tool_pwr);
       }
       break;
     case NON_MODAL_SET_COORDINATE_DATA:
@@ -344,7 +442,9 @@ uint8_t gc_execute_line(char *line)
             }
           }
         }
-        settings_write_coord_data(int_value,coord_data);
+        // A dry run must not change the stored coordinate systems
+        if (sys.state != STATE_DRY_RUN)
+          settings_write_coord_data(int_value,coord_data);
         // Update system coordinate system if currently active.
         if (gc.coord_select == int_value)
             memcpy(gc.coord_system,coord_data,sizeof(coord_data));
@@ -389,11 +489,14 @@ uint8_t gc_execute_line(char *line)
       axis_words = 0; // Axis words used. Lock out from motion modes by clearing flags.
       break;
     case NON_MODAL_SET_HOME_0: case NON_MODAL_SET_HOME_1:
-      if (non_modal_action == NON_MODAL_SET_HOME_1) {
-        settings_write_coord_data(SETTING_INDEX_G30,gc.position);
-      }
-      else {
-        settings_write_coord_data(SETTING_INDEX_G28,gc.position);
+      // A dry run must not change the stored home positions
+      if (sys.state != STATE_DRY_RUN) {
+        if (non_modal_action == NON_MODAL_SET_HOME_1) {
+          settings_write_coord_data(SETTING_INDEX_G30,gc.position);
+        }
+        else {
+          settings_write_coord_data(SETTING_INDEX_G28,gc.position);
+        }
       }
       break;
     case NON_MODAL_SET_COORDINATE_OFFSET:
@@ -486,6 +589,18 @@ uint8_t gc_execute_line(char *line)
           FAIL(STATUS_INVALID_STATEMENT);
         }
         else {
+#ifdef LASER_RASTER
+          if (raster_count) {
+            // Pixels 0...255 are 0...100% of the tool power S
+            float scale = min(gc.tool_pwr, 100.0)*TOOL_PWR_MAX/(100.0*255.0);
+            uint8_t i;
+            for (i=0; i<raster_count; i++) { raster[i] = raster[i]*scale + 0.5; }
+            mc_raster(target[X_AXIS], target[Y_AXIS], target[U_AXIS], target[Z_AXIS],
+                (gc.inverse_feed_rate_mode) ? inverse_feed_rate : gc.feed_rate, gc.inverse_feed_rate_mode, gc.tool_state, 
+                gc.tool_pwr, raster, raster_count);
+            break;
+          }
+#endif
 /// 8c1 :line
           mc_line(target[X_AXIS], target[Y_AXIS], target[U_AXIS], target[Z_AXIS],
                 (gc.inverse_feed_rate_mode) ? inverse_feed_rate : gc.feed_rate, gc.inverse_feed_rate_mode, C_LINE, gc.tool_state, gc.tool_pwr);
@@ -498,6 +613,10 @@ uint8_t gc_execute_line(char *line)
              ( !r && !offset[gc.plane_axis_0] && !offset[gc.plane_axis_1] ) ) {
           FAIL(STATUS_INVALID_STATEMENT);
         } else {
+          // Set clockwise/counter-clockwise sign for mc_arc computations
+          uint8_t isclockwise = false;
+          if (gc.motion_mode == MOTION_MODE_CW_ARC) { isclockwise = true; }
+
           if (r != 0) { // Arc Radius Mode
             /*
               We need to calculate the center of the circle that has the designated radius and passes
@@ -553,15 +672,9 @@ uint8_t gc_execute_line(char *line)
             float x = target[gc.plane_axis_0]-gc.position[gc.plane_axis_0];
             float y = target[gc.plane_axis_1]-gc.position[gc.plane_axis_1];
 
-            clear_vector(offset);
             // First, use h_x2_div_d to compute 4*h^2 to check if it is negative or r is smaller
-            // than d. If so, the sqrt of a negative number is complex and error out.
-            float h_x2_div_d = 4 * r*r - x*x - y*y;
-            if (h_x2_div_d < 0) { FAIL(STATUS_ARC_RADIUS_ERROR); return(gc.status_code); }
-            // Finish computing h_x2_div_d.
-            h_x2_div_d = -sqrt(h_x2_div_d)/hypot(x,y); // == -(h * 2 / d)
-            // Invert the sign of h_x2_div_d if the circle is counter clockwise (see sketch below)
-            if (gc.motion_mode == MOTION_MODE_CCW_ARC) { h_x2_div_d = -h_x2_div_d; }
+            // than d. If so, the sqrt of a negative number is complex and error out. Then invert the 
+            // sign of h_x2_div_d if the circle is counter clockwise (see sketch below).
 
             /* The counter clockwise circle lies to the left of the target direction. When offset is positive,
                the left hand circle will be generated - when it is negative the right hand circle is generated.
@@ -584,26 +697,34 @@ uint8_t gc_execute_line(char *line)
             // even though it is advised against ever generating such circles in a single line of g-code. By
             // inverting the sign of h_x2_div_d the center of the circles is placed on the opposite side of the line of
             // travel and thus we get the unadvisably long arcs as prescribed.
-            if (r < 0) {
-                h_x2_div_d = -h_x2_div_d;
-                r = -r; // Finished with r. Set to positive for mc_arc
+            if (!arc_offset_from_radius(x, y, r, isclockwise, &offset[gc.plane_axis_0], &offset[gc.plane_axis_1])) {
+              FAIL(STATUS_ARC_RADIUS_ERROR); return(gc.status_code);
             }
-            // Complete the operation by calculating the actual center of the arc
-            offset[gc.plane_axis_0] = 0.5*(x-(y*h_x2_div_d));
-            offset[gc.plane_axis_1] = 0.5*(y+(x*h_x2_div_d));
-
-          } else { // Arc Center Format Offset Mode
-            r = hypot(offset[gc.plane_axis_0], offset[gc.plane_axis_1]); // Compute arc radius for mc_arc
           }
 
-          // Set clockwise/counter-clockwise sign for mc_arc computations
-          uint8_t isclockwise = false;
-          if (gc.motion_mode == MOTION_MODE_CW_ARC) { isclockwise = true; }
+          // Dual plane arc: the UZ tower follows its own arc, center offsets A (U) and B (Z) or radius
+          // Q. Only in the XY plane (G17), the UZ plane is its counterpart on the second tower.
+          if (uz_arc) {
+            if ((gc.plane_axis_0 != X_AXIS) || (gc.plane_axis_1 != Y_AXIS)) {
+              FAIL(STATUS_INVALID_STATEMENT); return(gc.status_code);
+            }
+            // K is no center offset in the XY plane, the UZ arc takes its place in the offsets
+            offset[U_AXIS] = uz_offset[0];
+            offset[Z_AXIS] = uz_offset[1];
+            if (q != 0) {
+              if (!arc_offset_from_radius(target[U_AXIS]-gc.position[U_AXIS], target[Z_AXIS]-gc.position[Z_AXIS],
+                                          q, isclockwise, &offset[U_AXIS], &offset[Z_AXIS])) {
+                FAIL(STATUS_ARC_RADIUS_ERROR); return(gc.status_code);
+              }
+            } else if (!offset[U_AXIS] && !offset[Z_AXIS]) {
+              FAIL(STATUS_INVALID_STATEMENT); return(gc.status_code);
+            }
+          }
 
           // Trace the arc
-          mc_arc(gc.position, target, offset, gc.plane_axis_0, gc.plane_axis_1, gc.plane_axis_2,
+          mc_arc(gc.position, target, offset, gc.plane_axis_0, gc.plane_axis_1, uz_arc,
             (gc.inverse_feed_rate_mode) ? inverse_feed_rate : gc.feed_rate, gc.inverse_feed_rate_mode,
-            r, isclockwise, gc.tool_state, gc.tool_pwr);
+            isclockwise, gc.tool_state, gc.tool_pwr);
         }
         break;
     }
@@ -625,7 +746,8 @@ uint8_t gc_execute_line(char *line)
 
     // If complete, reset to reload defaults (G92.2,G54,G17,G90,G94,M48,G40,M5,M9). Otherwise,
     // re-enable program flow after pause complete, where cycle start will resume the program.
-    if (gc.program_flow == PROGRAM_FLOW_COMPLETED) { mc_reset(); }
+    // A dry run continues to the end of the file.
+    if ((gc.program_flow == PROGRAM_FLOW_COMPLETED) && (sys.state != STATE_DRY_RUN)) { mc_reset(); }
     else { gc.program_flow = PROGRAM_FLOW_RUNNING; }
   }
 
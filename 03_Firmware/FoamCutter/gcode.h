@@ -20,6 +20,7 @@
 #define MODAL_GROUP_6 7 // [G20,G21] Units
 #define MODAL_GROUP_7 8 // [M3,M4,M5] Spindle turning
 #define MODAL_GROUP_12 9 // [G54,G55,G56,G57,G58,G59] Coordinate system selection
+#define MODAL_GROUP_13 10 // [G61,G64] Path control mode
 
 // Define command actions for within execution-type modal groups (motion, stopping, non-modal). Used
 // internally by the parser to know which command to execute.
@@ -33,6 +34,9 @@
 #define PROGRAM_FLOW_PAUSED 1 // M0, M1
 #define PROGRAM_FLOW_COMPLETED 2 // M2, M30
 
+#define PATH_MODE_EXACT 0 // G61
+#define PATH_MODE_BLEND 1 // G64
+
 #define NON_MODAL_NONE 0
 #define NON_MODAL_DWELL 1 // G4
 #define NON_MODAL_SET_COORDINATE_DATA 2 // G10
@@ -50,6 +54,8 @@ typedef struct {
   uint8_t inches_mode;             // 0 = millimeter mode, 1 = inches mode {G20, G21}
   uint8_t absolute_mode;           // 0 = relative motion, 1 = absolute motion {G90, G91}
   uint8_t program_flow;            // {M0, M1, M2, M30}
+  uint8_t path_mode;               // {G61, G64}
+  float   path_tolerance;          // Path tolerance of G64 in mm
   int8_t  tool_state;              // state of the tool
   float   tool_pwr;                // tool power 0...100%  
        
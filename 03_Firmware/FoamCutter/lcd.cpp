@@ -21,6 +21,7 @@ U8G2_ST7920_128X64_F_SW_SPI lcd(U8G2_R0, //orientation
 #include "gcode.h"
 #include "report.h"
 #include "protocol.h"
+#include "motion_control.h"
 
 
 
@@ -64,7 +65,12 @@ SdFile root;
 SdFile file;
 
 #define SD_LINE_BUFFER_SIZE  256
+#define SD_READ_BUFFER_SIZE  512             // one sector of the sd card
+#define SD_PROGRESS_REFRESH  333             // refresh period of the progress screen in msec (3 Hz)
+#define SD_PROGRESS_ROWS     8               // tile rows of 8 pixels of the display, one is sent per pass
 void sd_protocol_process();
+bool sd_protocol_running();
+void sd_protocol_override_step(int8_t increment);
 typedef struct {
   char      filename[18]; 
   uint8_t   fileIndex;
@@ -72,9 +78,27 @@ typedef struct {
   uint32_t  bytesProcessed;
   char      lineBuffer[SD_LINE_BUFFER_SIZE];
   uint16_t  lineBufferIndex;
+  uint8_t   readBuffer[SD_READ_BUFFER_SIZE];  // sector buffer for reading the file
+  uint16_t  readBufferIndex;                  // next byte to be tokenized from readBuffer
+  uint16_t  readBufferFill;                   // number of valid bytes in readBuffer
+  uint32_t  linesProcessed;                   // statistics: number of gcode lines read
+  uint32_t  readTime;                         // statistics: time spent in reading the file in usec
+  uint32_t  startTime;                        // statistics: start of the execution in msec
+  uint32_t  jobTime;                          // statistics: duration of the execution in msec
+  uint32_t  refreshLast;                      // time of the last refresh of the progress screen in msec
+  uint8_t   refreshRow;                       // next tile row of the progress screen to be sent to the display
+  uint32_t  linesRefresh;                     // statistics: lines executed in passes with a display transfer
+  uint32_t  timeRefresh;                      // statistics: duration of the passes with a display transfer in usec
+  uint32_t  linesPlain;                       // statistics: lines executed in passes without a display transfer
+  uint32_t  timePlain;                        // statistics: duration of the passes without a display transfer in usec
   uint8_t   errors;
   uint8_t   stateProcessFile;        // state machine for processing a file from sd card
   bool      isComment;
+  bool      estimating;                       // the file is read for the job time estimate (dry run)
+  bool      estimated;                        // estimate of the file available
+  uint16_t  estimateErrors;                   // number of lines with errors in the dry run
+  mc_estimate_t estimate;                     // job time estimate of the dry run
+  bool      overrideTool;                     // the rotary encoder changes the tool power instead of the feed
 } sd_t;
 sd_t sd_data;
 
@@ -91,6 +115,7 @@ typedef struct {
   uint32_t  buttons_cnt;             // counter to stabilize the buttons
   uint32_t  buttons_image;           // image of the current buttons to be stabilized
   uint8_t   encoder_state;           // rotary encoder State
+  uint32_t  encoder_edges;           // steps of the rotary encoder since the last lcd_process()
   uint8_t   refresh; 
   float     fvalue;
   float     cutting_start_position[N_AXIS];
@@ -280,6 +305,7 @@ void lcd_init() {
   lcd_data.refresh                    = 1;
   lcd_data.use_seek_speed             = 0;
   lcd_data.encoder_state              = R_START;
+  lcd_data.encoder_edges              = 0;
   
   lcd_data.cutting_start_position[X_AXIS]  = 0;
   lcd_data.cutting_start_position[Y_AXIS]  = 0;
@@ -291,6 +317,10 @@ void lcd_init() {
   sd_data.stateProcessFile            = 0;
   sd_data.lineBufferIndex             = 0;           
   sd_data.bytesProcessed              = 0;
+  sd_data.readBufferIndex             = 0;
+  sd_data.readBufferFill              = 0;
+  sd_data.estimating                  = false;
+  sd_data.overrideTool                = false;
 
   lcd.begin();
 
@@ -2224,6 +2254,24 @@ uint8_t lcd_process_encoder() {
   return lcd_data.encoder_state & 0x30;
 }
 
+
+// Polls the encoder from the main loop and from protocol_execute_runtime(), so no step is lost
+// while the main program waits for the planner. While a job from the sd card runs, a step changes 
+// the override at once, otherwise it is latched as an edge for the next lcd_process().
+void lcd_poll_encoder() {
+  uint8_t result = lcd_process_encoder();
+  if (result == DIR_NONE) {
+    return;
+  }
+  if (sd_protocol_running()) {
+    sd_protocol_override_step((result == DIR_CW) ? OVERRIDE_ENCODER_INCREMENT : -OVERRIDE_ENCODER_INCREMENT);
+  } else if (result == DIR_CW) {
+    lcd_data.encoder_edges |= BTN_ROTARY_RIGHT;
+  } else {
+    lcd_data.encoder_edges |= BTN_ROTARY_LEFT;
+  }
+}
+
 void lcd_process(){
   // read the buttons and stabilize
   uint32_t image = 0;
@@ -2302,14 +2350,10 @@ void lcd_process(){
   }
 #endif
 
-  // process the encoder
-  uint8_t result = lcd_process_encoder();
-  if (result == DIR_CW) {
-    lcd_data.buttons_redge |= BTN_ROTARY_RIGHT;
-  } 
-  else if (result == DIR_CCW) {
-    lcd_data.buttons_redge |= BTN_ROTARY_LEFT;
-  }
+  // process the encoder, including the steps latched while the main program was waiting
+  lcd_poll_encoder();
+  lcd_data.buttons_redge |= lcd_data.encoder_edges;
+  lcd_data.encoder_edges  = 0;
 
   
   // show and handle menues
@@ -2341,66 +2385,232 @@ void lcd_process(){
 
 
 
+// Reads the next gcode line from the sd card. The file is read sector wise into sd_data.readBuffer,
+// the tokenizer works on the buffered bytes and returns as soon as a complete and cleaned line
+// (no whitespace, no comments, upper case) is available in sd_data.lineBuffer. At most one sector
+// is read per call, so long comment blocks do not stall the main loop.
+// Result in sd_data.stateProcessFile:  6 = line not complete yet, 7 = line available, 
+//                                      8 = last line available,  9 = end of file, 0xF0 = read error
 void sd_protocol_getline() {
-  // read a byte from sd
-  char c;
-  if  (file.read(&c, 1) == 1) {
+  uint32_t  startTime = sys_micros();
+  bool      refilled  = false;
+  char      c;
+  
+  for (;;) {
+    if (sd_data.readBufferIndex >= sd_data.readBufferFill) {        // sector buffer is empty
+      if (refilled) {                                               // ... only one read per call
+        break;
+      }
+      int16_t n = file.read(sd_data.readBuffer, SD_READ_BUFFER_SIZE);
+      refilled = true;
+      if (n < 0) {                                                  // ... read error
+        sd_data.stateProcessFile                       = 0xF0;
+        break;
+      }
+      if (n == 0) {                                                 // ... end of file
+        if (sd_data.lineBufferIndex > 0) {                          // ... last line w/o line end
+          sd_data.lineBuffer[sd_data.lineBufferIndex]  = '\0';
+          sd_data.lineBufferIndex                      = 0;
+          sd_data.linesProcessed++;
+          sd_data.stateProcessFile                     = 8;         // and do final, processing 
+        } else {
+          sd_data.stateProcessFile                     = 9;         // close processing
+        }
+        sd_data.isComment                              = 0;
+        break;
+      }
+      sd_data.readBufferFill                           = n;
+      sd_data.readBufferIndex                          = 0;
+    }
     
+    c = sd_data.readBuffer[sd_data.readBufferIndex++];
     sd_data.bytesProcessed++;
     
-    
-    if ((c == '\n') || (c == '\r') || (c == '\0') || (sd_data.bytesProcessed == sd_data.fileSize)) {    
-                                                                    // check is line end has been reached            
+    if ((c == '\n') || (c == '\r') || (c == '\0')) {                // check is line end has been reached
+      sd_data.isComment                                = 0;
       if (sd_data.lineBufferIndex > 0) {                            // if valid gcode has been read
-        
-        if ((c == '\n') || (c == '\r') || (c == '\0')) {            // close the line
-          sd_data.lineBuffer[sd_data.lineBufferIndex]      = '\0'; 
-          sd_data.stateProcessFile                         = 7;     // and process it 
-        } else {
-          sd_data.lineBuffer[sd_data.lineBufferIndex + 1]  = '\0';
-          sd_data.stateProcessFile                         = 8;     // and do final, processing 
-        }
-      } else {
+        sd_data.lineBuffer[sd_data.lineBufferIndex]    = '\0';      // close the line
+        sd_data.lineBufferIndex                        = 0;
+        sd_data.linesProcessed++;
+        sd_data.stateProcessFile                       = 7;         // and process it 
+        break;
+      }
+      if (!sd_data.estimating) {
         report_status_message(STATUS_OK);                           // empty or comment line >>> Skip block with ok
-        if (sd_data.bytesProcessed == sd_data.fileSize) {           // if final line, 
-          sd_data.stateProcessFile                         = 9;     // close processing
-        }
       }
-      sd_data.lineBufferIndex   = 0;
-      sd_data.isComment         = 0;
-      if ((sd_data.bytesProcessed == sd_data.fileSize)) {
-        
+    } else if (sd_data.isComment) {                                 // throw away all comments until end of comment
+      if (c == ')') {
+        sd_data.isComment     = 0;
       }
-    } else {
-      if (sd_data.isComment) {                                      // throw away all comments until end of comment
-        if (c == ')') {
-          sd_data.isComment     = 0;
-        }
-      } else {
-        if (c <= ' ') {                                             // Throw away whitepace and control characters
-          
-        } else if (c == '/') {
+    } else if (c <= ' ') {                                          // Throw away whitepace and control characters
+      
+    } else if (c == '/') {
                                                                     // Block delete not supported. Ignore character.
-        } else if (c == '(') {                                      // Enable comments flag and ignore all characters until ')' or EOL.
-          sd_data.isComment     = 1;
-        } else if (sd_data.lineBufferIndex >= SD_LINE_BUFFER_SIZE-1) { // Report line buffer overflow and reset
-          
-          report_status_message(STATUS_OVERFLOW);   
-          sd_data.lineBufferIndex   = 0;
-          sd_data.isComment         = 0;
-        } else if (c >= 'a' && c <= 'z') {                          // Upcase lowercase and store the byte
-          sd_data.lineBuffer[sd_data.lineBufferIndex++] = c - 'a'+'A';
-        } else {
-          sd_data.lineBuffer[sd_data.lineBufferIndex++] = c;       // store the byte
-        }
-      }
+    } else if (c == '(') {                                          // Enable comments flag and ignore all characters until ')' or EOL.
+      sd_data.isComment       = 1;
+    } else if (sd_data.lineBufferIndex >= SD_LINE_BUFFER_SIZE-1) {  // Report line buffer overflow and reset
+      report_status_message(STATUS_OVERFLOW);   
+      sd_data.lineBufferIndex = 0;
+      sd_data.isComment       = 0;
+    } else if (c >= 'a' && c <= 'z') {                              // Upcase lowercase and store the byte
+      sd_data.lineBuffer[sd_data.lineBufferIndex++] = c - 'a'+'A';
+    } else {
+      sd_data.lineBuffer[sd_data.lineBufferIndex++] = c;            // store the byte
     }
+  }
+  
+  sd_data.readTime += sys_micros() - startTime;
+}
+
+
+// Reports the throughput of the finished job on the serial port. The line rates with and without
+// refresh are measured over the passes of the statemachine with and without a display transfer.
+void sd_protocol_statistics() {
+  float linesRefresh = 0;
+  float linesPlain   = 0;
+  
+  sd_data.jobTime = sys_millis() - sd_data.startTime;
+  if (sd_data.timeRefresh > 0) {
+    linesRefresh = (float)sd_data.linesRefresh * 1000000.0 / (float)sd_data.timeRefresh;
+  }
+  if (sd_data.timePlain > 0) {
+    linesPlain   = (float)sd_data.linesPlain * 1000000.0 / (float)sd_data.timePlain;
+  }
+  report_sd_statistics(sd_data.bytesProcessed, sd_data.linesProcessed, sd_data.readTime, sd_data.jobTime, 
+                       linesRefresh, linesPlain);
+}
+
+
+// Draws the progress screen into the buffer of the display while processing a file. Called time 
+// based (SD_PROGRESS_REFRESH) from the statemachine, the buffer is sent by sd_protocol_progress_send().
+void sd_protocol_progress() {
+  lcd.clearBuffer();
+  lcd.setFont(u8g2_font_helvB08_tr);
+  lcd.setCursor(  0,  8);  
+  if (sd_data.estimating) {
+    lcd.print(F("Estimate job time"));
   } else {
-    sd_data.stateProcessFile                         = 9;     // close processing
+    lcd.print(F("Process from SD-Card"));
   }
+  lcd.setFont(u8g2_font_helvR08_tr);
+  lcd.setCursor(  6, 20);  lcd.print(sd_data.filename);
+  lcd.drawRFrame( 6,  30, 116,   15,  2);           // ... draw progressbar
+  float progress = (float)sd_data.bytesProcessed;
+  progress *= 112;                                  // width of progressbar
+  progress /= (float)sd_data.fileSize;
+  if (progress > 112)
+    progress = 112;
+  lcd.drawBox   ( 8,  32, (u8g2_uint_t)progress,   11);   
+  uint32_t jobTime = sys_millis() - sd_data.startTime;
+  if (jobTime > 0) {                                // ... show the line rate
+    lcd.setCursor(  6, 56);  
+    lcd.print((float)sd_data.linesProcessed * 1000.0 / (float)jobTime, 1);
+    lcd.print(F(" lines/s"));
+  }
+  if (!sd_data.estimating) {                        // ... show the overrides, the selected one underlined
+    lcd.setCursor( 82, 56);  lcd.print('F');  lcd.print(sys.feed_override);
+    lcd.setCursor(105, 56);  lcd.print('P');  lcd.print(sys.tool_override);
+    lcd.drawHLine(sd_data.overrideTool ? 105 : 82, 58, 20);
+  }
+  
+  sd_data.refreshLast   = sys_millis();
+  sd_data.refreshRow    = 0;
 }
 
 
+// Sends the next tile row (128 x 8 pixels) of the progress screen to the display. A full transfer 
+// of the screen would stall the line execution, so it is split over the passes of the statemachine,
+// one row per executed line. Returns false, if the screen is sent completely.
+bool sd_protocol_progress_send() {
+  if (sd_data.refreshRow >= SD_PROGRESS_ROWS) {
+    return false;
+  }
+  lcd.updateDisplayArea(0, sd_data.refreshRow, 16, 1);
+  sd_data.refreshRow++;
+  return true;
+}
+
+
+// Changes the feed or tool power override with the rotary encoder while processing a file, the 
+// push button toggles between both. The progress screen is refreshed with the next line.
+void sd_protocol_override() {
+  if (lcd_data.buttons_redge & BTN_ROTARY_RIGHT) {
+    sd_protocol_override_step( OVERRIDE_ENCODER_INCREMENT);
+  } else if (lcd_data.buttons_redge & BTN_ROTARY_LEFT) {
+    sd_protocol_override_step(-OVERRIDE_ENCODER_INCREMENT);
+  } else if (lcd_data.buttons_redge & BTN_ROTARY_PUSH) {
+    sd_data.overrideTool = !sd_data.overrideTool;
+    sd_data.refreshLast  = sys_millis() - SD_PROGRESS_REFRESH;
+  } else {
+    return;
+  }
+  lcd_data.buttons_redge &= ~(BTN_ROTARY_RIGHT | BTN_ROTARY_LEFT | BTN_ROTARY_PUSH);
+}
+
+
+// Changes the feed override or the tool power override by increment in % and refreshes the progress
+void sd_protocol_override_step(int8_t increment) {
+  if (sd_data.overrideTool) {
+    tool_set_override(sys.tool_override + increment);
+  } else {
+    plan_set_feed_override(sys.feed_override + increment);
+  }
+  sd_data.refreshLast     = sys_millis() - SD_PROGRESS_REFRESH;
+}
+
+
+// Returns true while a job from the sd card is executed, not in the dry run of the estimate
+bool sd_protocol_running() {
+  return (sd_data.stateProcessFile >= 5) && (sd_data.stateProcessFile <= 8) && !sd_data.estimating;
+}
+
+
+// Prints a time in seconds as h:mm:ss, below one hour as m:ss
+void sd_print_time(float seconds) {
+  uint32_t s = lround(seconds);
+  if (s >= 3600) {
+    lcd.print(s / 3600);  lcd.print(':');
+    s %= 3600;
+    if (s < 600) lcd.print('0');
+  }
+  lcd.print(s / 60);  lcd.print(':');
+  if (s % 60 < 10) lcd.print('0');
+  lcd.print(s % 60);
+}
+
+// Ends the dry run of the job time estimate and reports the estimate
+void sd_protocol_estimate_end() {
+  mc_dry_run_end(&sd_data.estimate);
+  sd_data.estimating = false;
+  report_estimate(sd_data.estimate.cut_time, sd_data.estimate.travel_time, sd_data.estimate.dwell_time, 
+                  sd_data.estimate.stall_time, sd_data.estimate.blocks);
+}
+
+// Executes the line in sd_data.lineBuffer. The dry run of the estimate counts the errors instead of
+// reporting every line.
+void sd_protocol_execute() {
+  uint8_t status = gc_execute_line(sd_data.lineBuffer);
+  if (!sd_data.estimating) {
+    report_status_message(status);
+  } else if (status != STATUS_OK) {
+    sd_data.estimateErrors++;
+  }
+}
+
+// Called at the end of the file. After the estimate the file is rewound and the confirm screen 
+// shows the estimate, after the execution the statistics are reported.
+void sd_protocol_finish() {
+  if (sd_data.estimating) {
+    sd_protocol_estimate_end();
+    file.rewind();
+    sd_data.estimated         = true;
+    lcd_data.cursor_id        = 0;
+    sd_data.stateProcessFile  = 2;
+  } else {
+    sd_protocol_statistics();
+    sd_data.stateProcessFile  = 0xFD;
+  }
+}
 
 
 void sd_protocol_process() {
@@ -2417,12 +2627,18 @@ void sd_protocol_process() {
 
     sd_data.bytesProcessed        = 0;
     sd_data.lineBufferIndex       = 0;
+    sd_data.readBufferIndex       = 0;
+    sd_data.readBufferFill        = 0;
     sd_data.stateProcessFile      = 1;
     return;
   }
   
   lcd_data.refresh            =  0;
 
+  if (sd_data.estimating && (sd_data.stateProcessFile >= 0xF0)) {
+    sd_protocol_estimate_end();                     // aborted estimate, back to the state before
+  }
+
   if (sd_data.stateProcessFile == 0xFE) {          // error idle state ... wait for button
 
     tool_off();                                    // switch the tool off
@@ -2461,7 +2677,16 @@ void sd_protocol_process() {
       case 0xF4:  lcd.print(F("Unable to open directory."));            break;
       case 0xF5:  lcd.print(F("Unable to open file."));                 break;
       case 0xF6:  lcd.print(F("Interrupted by user."));                 break;
-      case 0xFD:  lcd.print(F("Finished."));                            break;
+      case 0xFD:  lcd.print(F("Finished."));
+                  lcd.setCursor(  6, 32);                       // ... show the throughput of the sd card reader
+                  lcd.print(sd_data.linesProcessed);  lcd.print(F(" lines, "));
+                  lcd.print(sd_data.jobTime / 1000);  lcd.print(F(" s"));
+                  if (sd_data.readTime > 0) {
+                    lcd.setCursor(  6, 44);  
+                    lcd.print((uint32_t)(sd_data.bytesProcessed * 1000000.0 / sd_data.readTime));  
+                    lcd.print(F(" B/s read"));
+                  }
+                  break;
       default:    lcd.print(F("Error unknown."));                       break;
     }
     
@@ -2503,7 +2728,7 @@ void sd_protocol_process() {
         if (fileIndex == sd_data.fileIndex) {         // .. if this is the file to be opened
           file.getName(sd_data.filename, 18);         // ... get filename and sSize    
           sd_data.fileSize          = file.fileSize();   
-          sd_data.stateProcessFile  = 2;
+          sd_data.stateProcessFile  = 10;             // ... estimate the job time first
           lcd_data.cursor_id        = 0;
           return;
         }
@@ -2514,12 +2739,41 @@ void sd_protocol_process() {
     sd_data.stateProcessFile = 0xF5;               // file not found
     return;
   } // if (sd_data.stateProcessFile == 1)
+
+  if (sd_data.stateProcessFile == 10) {            // estimate the job time with a dry run ...
+    memset(&sd_data.estimate, 0, sizeof(sd_data.estimate));
+    sd_data.estimated           = false;
+    sd_data.estimateErrors      = 0;
+    sd_data.estimating          = mc_dry_run_begin();
+    if (sd_data.estimating) {
+      sd_data.stateProcessFile  = 4;               // ... read the file as for the execution
+    } else {
+      sd_data.stateProcessFile  = 2;               // ... not idle, ask without estimate
+    }
+    return;
+  } // if (sd_data.stateProcessFile == 10)
+
   if (sd_data.stateProcessFile == 2) {             // ask for executing the selected file...
     lcd.clearBuffer();
     lcd.setFont(u8g2_font_helvB08_tr);
     lcd.setCursor(  0,  8);  lcd.print(F("Process from SD-Card"));
     lcd.setFont(u8g2_font_helvR08_tr);
     lcd.setCursor(  6, 20);  lcd.print(sd_data.filename);
+    if (sd_data.estimated) {                        // ... show the estimate of the dry run
+      lcd.setCursor(  6, 32);  lcd.print(F("Time "));
+      sd_print_time(sd_data.estimate.cut_time + sd_data.estimate.travel_time + sd_data.estimate.dwell_time);
+      lcd.print(F(", cut "));
+      sd_print_time(sd_data.estimate.cut_time);
+      lcd.setCursor(  6, 56);
+      if (sd_data.estimateErrors > 0) {
+        lcd.print(sd_data.estimateErrors);  lcd.print(F(" lines with errors"));
+      } else {
+        lcd.print(F("Travel "));
+        sd_print_time(sd_data.estimate.travel_time);
+        lcd.print(F(", stall "));
+        sd_print_time(sd_data.estimate.stall_time);
+      }
+    }
     lcd.setCursor(  6, 44);  lcd.print(F("Execute?"));
     lcd.setCursor( 80, 44);
     if (lcd_data.cursor_id == 0) {
@@ -2558,60 +2812,72 @@ void sd_protocol_process() {
   if (sd_data.stateProcessFile == 4) {             // prepare the processing 
     sd_data.bytesProcessed      = 0;
     sd_data.lineBufferIndex     = 0;
+    sd_data.readBufferIndex     = 0;
+    sd_data.readBufferFill      = 0;
+    sd_data.linesProcessed      = 0;
+    sd_data.readTime            = 0;
+    sd_data.startTime           = sys_millis();
+    sd_data.refreshRow          = SD_PROGRESS_ROWS;
+    sd_data.linesRefresh        = 0;
+    sd_data.timeRefresh         = 0;
+    sd_data.linesPlain          = 0;
+    sd_data.timePlain           = 0;
     sd_data.isComment           = false;
     sd_data.stateProcessFile    = 5;
     return;
   } // if (sd_data.stateProcessFile == 4)
   
-  if (sd_data.stateProcessFile == 5) {             // display progress 
-    lcd.clearBuffer();
-    lcd.setFont(u8g2_font_helvB08_tr);
-    lcd.setCursor(  0,  8);  lcd.print(F("Process from SD-Card"));
-    lcd.setFont(u8g2_font_helvR08_tr);
-    lcd.setCursor(  6, 20);  lcd.print(sd_data.filename);
-    lcd.drawRFrame( 6,  30, 116,   15,  2);         // ... draw progressbar
-    float progress = (float)sd_data.bytesProcessed;
-    progress *= 112;                                // width of progressbar
-    progress /= (float)sd_data.fileSize;
-    if (progress > 112)
-      progress = 112;
-    lcd.drawBox   ( 8,  32, (u8g2_uint_t)progress,   11);   
-    lcd.sendBuffer(); 
-
-    lcd_data.buttons_redge        = 0;              // ... reset all edge indicators
-    lcd_data.buttons_fedge        = 0; 
+  if (sd_data.stateProcessFile == 5) {             // draw the progress, sent row by row in state 6
+    uint32_t startTime = sys_micros();
+    sd_protocol_progress();
+    sd_data.timeRefresh          += sys_micros() - startTime;
     sd_data.stateProcessFile      = 6;
-    sd_data.lineBufferIndex       = 0;     
     return;
 
   } // if (sd_data.stateProcessFile == 5)
 
   if (sd_data.stateProcessFile == 6) {              // processing
-    sd_protocol_getline();                          // read the line (char by char!!!!
-    return;
-  }
-
-  if (sd_data.stateProcessFile == 7) {            
-    // line is available, send to gcode
-    report_status_message(gc_execute_line(sd_data.lineBuffer)); 
-    // continue 
-    sd_data.stateProcessFile  = 5;
+    if (!sd_data.estimating) {
+      sd_protocol_override();                       // ... push of the rotary encoder, see lcd_poll_encoder()
+    }
+    if ((sd_data.refreshRow >= SD_PROGRESS_ROWS) && (sys_millis() - sd_data.refreshLast >= SD_PROGRESS_REFRESH)) {
+      sd_data.stateProcessFile    = 5;              // ... time for the next refresh of the progress
+      return;
+    }
+    uint32_t startTime = sys_micros();
+    bool refreshing    = sd_protocol_progress_send();  // ... one row of the progress per pass
+    sd_protocol_getline();                          // read the next complete line
+    uint8_t lines      = 0;
+    if (sd_data.stateProcessFile == 7) {            
+      // line is available, send to gcode
+      sd_protocol_execute(); 
+      // continue with the next line, the progress is refreshed time based
+      sd_data.stateProcessFile  = 6;
+      lines            = 1;
+    }
+    if (refreshing) {                               // ... statistics of the line rate with and without refresh
+      sd_data.linesRefresh   += lines;
+      sd_data.timeRefresh    += sys_micros() - startTime;
+    } else {
+      sd_data.linesPlain     += lines;
+      sd_data.timePlain      += sys_micros() - startTime;
+    }
     return;
   } 
 
   if (sd_data.stateProcessFile == 8) {            
     // last line is available, send to gcode
-    report_status_message(gc_execute_line(sd_data.lineBuffer)); 
+    sd_protocol_execute(); 
     plan_synchronize();                                   // wait until all movements are done
     // finish
-    sd_data.stateProcessFile  = 0xFD;
+    sd_protocol_finish();
     return;
   } 
   if (sd_data.stateProcessFile == 9) {            
     // last line w/o gcode
     plan_synchronize();                                   // wait until all movements are done
     // finish
-    sd_data.stateProcessFile  = 0xFD;
+    sd_protocol_finish();
     return;
   } 
   
@@ -10,6 +10,9 @@ void lcd_init();
 // process gcode from sd card
 void lcd_process();
 
+// polls the rotary encoder, also called from protocol_execute_runtime()
+void lcd_poll_encoder();
+
 // displays a status message for critical error on the lcd (e-stopp or limit switch)
 void lcd_crit_error();
 
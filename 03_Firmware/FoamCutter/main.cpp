@@ -29,12 +29,14 @@ int main(void)
 {
  
   // Initialize system
+  sys_ram_init();         // Mark the free RAM for the stack statistics of $P
   serial_init();          // Setup serial baud rate and interrupts
   settings_init();        // Load grbl settings from EEPROM
   lcd_init();             // setup the lcd display
   
 
   st_init();              // Setup stepper pins and interrupt timers
+  sys_tick_init();        // Start the millisecond system tick
   sei();                  // Enable interrupts
    
   memset(&sys, 0, sizeof(sys));  // Clear all system variables
@@ -48,8 +50,12 @@ int main(void)
     // reset to finish the initialization process.
     if (sys.abort) {
       // Reset system.
+      sys.override = 0;           // Clear pending overrides and start with the programmed feed and power
+      sys.feed_override = 100;
+      sys.tool_override = 100;
       serial_reset_read_buffer(); // Clear serial read buffer
       plan_init(); // Clear block buffer and planner variables
+      mc_init(); // Clear segment held back for merging
       gc_init(); // Set g-code parser to default state
       protocol_init(); // Clear incoming line data and execute startup lines
       limits_init();
@@ -86,6 +92,7 @@ int main(void)
 
     protocol_execute_runtime();
     protocol_process();             // ... process the serial protocol
+    mc_line_idle();                 // ... send a held back segment, if no more follow
     
     lcd_process();                  // ... lcd, menu, buttons
                                     // ... process gcode from sd-card
@@ -1,5 +1,4 @@
 #include <avr/io.h>
-#include <util/delay.h>
 #include <math.h>
 #include <stdlib.h>
 #include "settings.h"
@@ -17,44 +16,81 @@
 #include "report.h"
 #include "gcode.h"
 
-// Execute linear motion in absolute millimeter coordinates. Feed rate given in millimeters/second
-// unless invert_feed_rate is true. Then the feed_rate means that the motion should be completed in
-// (1 minute)/feed_rate time.
-// NOTE: This is the primary gateway to the grbl planner. All line motions, including arc line
-// segments, must pass through this routine before being passed to the planner. The seperation of
-// mc_line and plan_buffer_line is done primarily to make backlash compensation integration simple
-// and direct.
-// TODO: Check for a better way to avoid having to push the arguments twice for non-backlash cases.
-// However, this keeps the memory requirements lower since it doesn't have to call and hold two
-// plan_buffer_lines in memory. Grbl only has to retain the original line input variables during a
-// backlash segment(s).
-/// 8c1
+mc_statistics_t mc_stats;                        // Arc performance counters
 
-void mc_line(float x, float y, float u, float z, float feed_rate, uint8_t invert_feed_rate, uint8_t t_curve, int8_t tool_state, float tool_pwr)
+static mc_estimate_t estimate;                   // Estimate of the running dry run
+static float dwell_run;                          // Time of the current run of consecutive dwells in sec
+static parser_state_t dry_run_gc;                // Parser state before the dry run
+static uint8_t dry_run_auto_start;               // Auto start flag before the dry run
+static float dry_run_ahead;                      // Time the started blocks end after now in sec, see
+                                                 // mc_dry_run_advance(), negative while idle
+static uint32_t dry_run_micros;                  // sys_micros() of the last clock update
+
+// Adds the execution time of the planner block to the estimate of the dry run and discards the 
+// block. Returns the execution time in sec.
+static float mc_dry_run_block(block_t *block)
 {
-  // TODO: Perform soft limit check here. Just check if the target x,y,z values are outside the
-  // work envelope. Should be straightforward and efficient. By placing it here, rather than in
-  // the g-code parser, it directly picks up motions from everywhere in Grbl.
+  float time = plan_block_time(block);
+  if (block->flags & BLOCK_FLAG_DWELL) {
+    estimate.dwell_time += time;
+    dwell_run += time;
+    estimate.stall_time = max(estimate.stall_time, dwell_run);
+  } else {
+    if ((block->tool_state == 3) || (block->tool_state == 4)) { estimate.cut_time += time; }  // M3, M4
+    else { estimate.travel_time += time; }
+    dwell_run = 0.0;
+  }
+  estimate.blocks++;
+  #ifdef LASER_RASTER
+    if (block->raster_count) { plan_discard_raster(block->raster, block->raster_count); }
+  #endif
+  plan_discard_current_block();
+  return(time);
+}
 
-  // If in check gcode mode, prevent motion by blocking planner.
-  if (sys.state == STATE_CHECK_MODE) { return; }
 
-  // TODO: Backlash compensation may be installed here. Only need direction info to track when
-  // to insert a backlash line motion(s) before the intended line motion. Requires its own
-  // plan_check_full_buffer() and check for system abort loop. Also for position reporting
-  // backlash steps will need to be also tracked. Not sure what the best strategy is for this,
-  // i.e. keep the planner independent and do the computations in the status reporting, or let
-  // the planner handle the position corrections. The latter may get complicated.
+// Advances the clock of the dry run by the time spent parsing and planning since the last call and 
+// starts the blocks the stepper would have started by then, each one when the previous one ends. So 
+// the buffer fills and drains like in the real job and the planner slowdown and the arc segments of 
+// a low buffer are planned the same way. With wait the clock jumps to the end of the running block, 
+// as the parser waits for a free block of a full buffer. A block is discarded when it starts, one 
+// block earlier than the stepper would. Without the load of the stepper interrupt the parser runs a
+// bit faster than in the real job, so the buffer runs low a bit less often.
+static void mc_dry_run_advance(uint8_t wait)
+{
+  uint32_t now = sys_micros();
+  float since = (now - dry_run_micros)*1e-6;    // Blocks not started yet arrived within this time
+  dry_run_micros = now;
+  dry_run_ahead -= since;
+  if (wait && (dry_run_ahead > 0.0)) {
+    since += dry_run_ahead;
+    dry_run_ahead = 0.0;
+  }
+  block_t *block;
+  while (((block = plan_get_current_block()) != NULL) && (dry_run_ahead <= 0.0)) {
+    dry_run_ahead = max(dry_run_ahead, -since) + mc_dry_run_block(block);
+  }
+}
 
+
+// Waits for a free block in the planner buffer. Returns false on system abort.
+static uint8_t mc_wait_for_block()
+{
   // If the buffer is full: good! That means we are well ahead of the robot.
   // Remain in this loop until there is room in the buffer.
   do {
     protocol_execute_runtime(); // Check for any run-time commands
-    if (sys.abort) { return; } // Bail, if system abort.
+    if (sys.abort) { return(false); } // Bail, if system abort.
+    // A dry run starts the blocks due by now, with a full buffer it waits for the running block
+    if (sys.state == STATE_DRY_RUN) { mc_dry_run_advance(plan_check_full_buffer()); }
   } while ( plan_check_full_buffer() );
+  return(true);
+}
 
-  plan_buffer_line(x, y, u, z, feed_rate, invert_feed_rate, t_curve, tool_state, tool_pwr);
 
+// Starts the cycle after a new block was added to the planner buffer.
+static void mc_cycle_start()
+{
   // If idle, indicate to the system there is now a planned block in the buffer ready to cycle
   // start. Otherwise ignore and continue on.
   if (!sys.state) { sys.state = STATE_QUEUED; }
@@ -71,42 +107,615 @@ void mc_line(float x, float y, float u, float z, float feed_rate, uint8_t invert
 }
 
 
-// Execute an arc in offset mode format. position == current xyz, target == target xyz,
-// offset == offset from current xyz, axis_XXX defines circle plane in tool space, axis_linear is
-// the direction of helical travel, radius == circle radius, isclockwise boolean. Used
-// for vector transformation direction.
-// The arc is approximated by generating a huge number of tiny, linear segments. The length of each
-// segment is configured in settings.mm_per_arc_segment.
-void mc_arc(float *position, float *target, float *offset, uint8_t axis_0, uint8_t axis_1,
-  uint8_t axis_linear, float feed_rate, uint8_t invert_feed_rate, float radius, uint8_t isclockwise, int8_t tool_state, float tool_pwr)
+// Sends a linear motion to the planner, waits for a free block in the buffer and starts the cycle.
+static void mc_buffer_block(float x, float y, float u, float z, float feed_rate, uint8_t invert_feed_rate, uint8_t t_curve, int8_t tool_state, float tool_pwr)
+{
+  // TODO: Backlash compensation may be installed here. Only need direction info to track when
+  // to insert a backlash line motion(s) before the intended line motion. Requires its own
+  // plan_check_full_buffer() and check for system abort loop. Also for position reporting
+  // backlash steps will need to be also tracked. Not sure what the best strategy is for this,
+  // i.e. keep the planner independent and do the computations in the status reporting, or let
+  // the planner handle the position corrections. The latter may get complicated.
+
+  if (!mc_wait_for_block()) { return; }
+  plan_buffer_line(x, y, u, z, feed_rate, invert_feed_rate, t_curve, tool_state, tool_pwr);
+  if (t_curve == C_ARC) { mc_stats.arc_blocks++; }
+  mc_cycle_start();
+}
+
+
+// Sends a linear motion to the planner. A block holds at most BLOCK_MAX_STEP_EVENTS step events, so
+// longer lines are split into equal parts. With inverse time feed rate each part gets its share of time.
+static void mc_buffer_line(float x, float y, float u, float z, float feed_rate, uint8_t invert_feed_rate, uint8_t t_curve, int8_t tool_state, float tool_pwr)
+{
+  float position[N_AXIS];
+  float delta[N_AXIS];
+  plan_get_position(position);
+  delta[X_AXIS] = x - position[X_AXIS];
+  delta[Y_AXIS] = y - position[Y_AXIS];
+  delta[Z_AXIS] = z - position[Z_AXIS];
+  delta[U_AXIS] = u - position[U_AXIS];
+
+  float step_events = 0.0;
+  uint8_t idx;
+  for (idx=0; idx<N_AXIS; idx++) {
+    step_events = max(step_events, fabs(delta[idx])*settings.steps_per_mm[idx]);
+  }
+
+  if (step_events > BLOCK_MAX_STEP_EVENTS) {
+    uint16_t parts = ceil(step_events/BLOCK_MAX_STEP_EVENTS);
+    uint16_t part;
+    if (invert_feed_rate) { feed_rate *= parts; }
+    for (part=1; part<parts; part++) {
+      float fraction = (float)part/parts;
+      mc_buffer_block(position[X_AXIS]+fraction*delta[X_AXIS], position[Y_AXIS]+fraction*delta[Y_AXIS],
+                      position[U_AXIS]+fraction*delta[U_AXIS], position[Z_AXIS]+fraction*delta[Z_AXIS],
+                      feed_rate, invert_feed_rate, t_curve, tool_state, tool_pwr);
+      if (sys.abort) { return; }
+    }
+  }
+  mc_buffer_block(x, y, u, z, feed_rate, invert_feed_rate, t_curve, tool_state, tool_pwr);
+}
+
+
+
+
+#ifdef LINE_MERGE
+// Segment held back by mc_line() to merge the following nearly collinear segments into it.
+typedef struct {
+  uint8_t  count;                                     // Number of merged segments, 0 = nothing pending
+  float    start[N_AXIS];                             // Start of the pending segment in mm
+  float    target[N_AXIS];                            // End of the pending segment in mm
+  float    point[LINE_MERGE_MAX_POINTS-1][N_AXIS];    // Ends of all merged segments except the last
+  float    feed_rate;
+  uint8_t  t_curve;
+  int8_t   tool_state;
+  float    tool_pwr;
+  uint32_t time;                                      // Time of the last merged segment in msec
+} mc_merge_t;
+static mc_merge_t merge;
+
+
+// Checks a point against the chord from the pending start to the target in the plane of axis_0 
+// and axis_1. The point must lie within the line merge tolerance to the chord and between start 
+// and target. Returns the position along the chord (0...1) in *t, or -1 if the plane doesn't move.
+static uint8_t mc_merge_plane_check(float *point, float *target, uint8_t axis_0, uint8_t axis_1, float *t)
+{
+  float chord_0   = target[axis_0] - merge.start[axis_0];
+  float chord_1   = target[axis_1] - merge.start[axis_1];
+  float p_0       = point[axis_0]  - merge.start[axis_0];
+  float p_1       = point[axis_1]  - merge.start[axis_1];
+  float chord_sq  = chord_0*chord_0 + chord_1*chord_1;
+  float tol_sq    = settings.line_merge_tolerance*settings.line_merge_tolerance;
+  
+  if (chord_sq == 0.0) {                              // Plane doesn't move, point must be at start
+    *t = -1.0;
+    return(p_0*p_0 + p_1*p_1 <= tol_sq);
+  }
+  float dot = p_0*chord_0 + p_1*chord_1;
+  if ((dot < 0.0) || (dot > chord_sq)) { return(false); }   // Point is not between start and target
+  *t = dot/chord_sq;
+  float cross = p_0*chord_1 - p_1*chord_0;            // Distance to the chord times chord length
+  return(cross*cross <= tol_sq*chord_sq);
+}
+
+
+// Checks if a point of the pending segment stays within the tolerance, if the pending segment 
+// is extended to target. Both wire ends must be at the same position along their chords, 
+// otherwise the wire would cut a different surface between the planes.
+static uint8_t mc_merge_point_check(float *point, float *target)
+{
+  float t_xy, t_uz;
+  
+  if (!mc_merge_plane_check(point, target, X_AXIS, Y_AXIS, &t_xy)) { return(false); }
+  if (!mc_merge_plane_check(point, target, U_AXIS, Z_AXIS, &t_uz)) { return(false); }
+  if ((t_xy < 0.0) || (t_uz < 0.0)) { return(true); } // Only one plane moves
+  
+  float dx = target[X_AXIS] - merge.start[X_AXIS];
+  float dy = target[Y_AXIS] - merge.start[Y_AXIS];
+  float du = target[U_AXIS] - merge.start[U_AXIS];
+  float dz = target[Z_AXIS] - merge.start[Z_AXIS];
+  float chord_sq = max(dx*dx + dy*dy, du*du + dz*dz);
+  float dt = t_xy - t_uz;
+  return(dt*dt*chord_sq <= settings.line_merge_tolerance*settings.line_merge_tolerance);
+}
+
+
+// Checks if the segment to target can be merged into the pending segment
+static uint8_t mc_merge_check(float *target, float feed_rate, uint8_t t_curve, int8_t tool_state, float tool_pwr)
+{
+  if (merge.count >= LINE_MERGE_MAX_POINTS) { return(false); }
+  if ((feed_rate != merge.feed_rate) || (t_curve != merge.t_curve) ||
+      (tool_state != merge.tool_state) || (tool_pwr != merge.tool_pwr)) { return(false); }
+  
+  // The end of the pending segment becomes an intermediate point, all others must still fit
+  if (!mc_merge_point_check(merge.target, target)) { return(false); }
+  uint8_t i;
+  for (i=0; i<merge.count-1; i++) {
+    if (!mc_merge_point_check(merge.point[i], target)) { return(false); }
+  }
+  return(true);
+}
+#endif
+
+
+// Sends the segment held back for merging to the planner
+static void mc_merge_flush()
+{
+#ifdef LINE_MERGE
+  if (merge.count) {
+    merge.count = 0;
+    mc_buffer_line(merge.target[X_AXIS], merge.target[Y_AXIS], merge.target[U_AXIS], merge.target[Z_AXIS],
+                   merge.feed_rate, false, merge.t_curve, merge.tool_state, merge.tool_pwr);
+  }
+#endif
+}
+
+
+// Returns the end of the last segment passed to mc_merge_line() in mm
+static void mc_merge_position(float *position)
+{
+#ifdef LINE_MERGE
+  if (merge.count) {
+    memcpy(position, merge.target, sizeof(merge.target));
+    return;
+  }
+#endif
+  plan_get_position(position);
+}
+
+
+// Sends a linear motion to the planner. With LINE_MERGE the segment may be held back and merged with
+// the following segments into one planner block. See mc_merge_flush().
+static void mc_merge_line(float x, float y, float u, float z, float feed_rate, uint8_t invert_feed_rate, uint8_t t_curve, int8_t tool_state, float tool_pwr)
+{
+#ifdef LINE_MERGE
+  // Inverse time motions are not merged, the time of each segment is given by the gcode. Arc
+  // segments are not merged, mc_arc() already chose their length for the arc tolerance ($40) and
+  // merging them would add the line merge tolerance ($39) to it.
+  if ((settings.line_merge_tolerance > 0.0) && (!invert_feed_rate) && (t_curve != C_ARC)) {
+    float target[N_AXIS];
+    target[X_AXIS] = x;
+    target[Y_AXIS] = y;
+    target[U_AXIS] = u;
+    target[Z_AXIS] = z;
+    
+    if (merge.count) {
+      if (mc_merge_check(target, feed_rate, t_curve, tool_state, tool_pwr)) {
+        memcpy(merge.point[merge.count-1], merge.target, sizeof(target));
+        memcpy(merge.target, target, sizeof(target));
+        merge.count++;
+        merge.time = sys_millis();
+        return;
+      }
+      mc_merge_flush();
+      if (sys.abort) { return; }
+    }
+    
+    // Hold the segment back for merging only while the planner has blocks to execute. 
+    if (plan_get_current_block() != NULL) {
+      plan_get_position(merge.start);
+      memcpy(merge.target, target, sizeof(target));
+      merge.feed_rate   = feed_rate;
+      merge.t_curve     = t_curve;
+      merge.tool_state  = tool_state;
+      merge.tool_pwr    = tool_pwr;
+      merge.time        = sys_millis();
+      merge.count       = 1;
+      return;
+    }
+  } else {
+    mc_merge_flush();
+    if (sys.abort) { return; }
+  }
+#endif
+
+  mc_buffer_line(x, y, u, z, feed_rate, invert_feed_rate, t_curve, tool_state, tool_pwr);
+}
+
+
+
+
+#ifdef PATH_BLENDING
+// Segment held back by mc_line() in continuous path mode (G64) to round the corner at its end.
+typedef struct {
+  uint8_t  pending;                                   // True, if a segment is held back
+  float    start[N_AXIS];                             // Start of the held back segment in mm
+  float    corner[N_AXIS];                            // End of the held back segment in mm
+  float    feed_rate;
+  int8_t   tool_state;
+  float    tool_pwr;
+  uint32_t time;                                      // Time the segment was held back in msec
+} mc_blend_t;
+static mc_blend_t blend;
+static float blend_tolerance;                         // Path tolerance in mm, 0 = exact path mode (G61)
+
+
+// Returns the length of a segment as the planner computes it for a block. On the foam cutter this
+// is the travel of the longer plane.
+static float mc_segment_length(float *delta)
+{
+#ifdef FOAM_CUTTER
+  return( max(sqrt(delta[X_AXIS]*delta[X_AXIS] + delta[Y_AXIS]*delta[Y_AXIS]),
+              sqrt(delta[U_AXIS]*delta[U_AXIS] + delta[Z_AXIS]*delta[Z_AXIS])) );
+#else
+  return( sqrt(delta[X_AXIS]*delta[X_AXIS] + delta[Y_AXIS]*delta[Y_AXIS] +
+               delta[U_AXIS]*delta[U_AXIS] + delta[Z_AXIS]*delta[Z_AXIS]) );
+#endif
+}
+
+
+// Sends the segment held back for blending to the merge stage
+static void mc_blend_flush()
+{
+  if (blend.pending) {
+    blend.pending = false;
+    mc_merge_line(blend.corner[X_AXIS], blend.corner[Y_AXIS], blend.corner[U_AXIS], blend.corner[Z_AXIS],
+                  blend.feed_rate, false, C_LINE, blend.tool_state, blend.tool_pwr);
+  }
+}
+
+
+// Rounds the corner between the held back segment and the segment to target. The corner is replaced 
+// by a quadratic Bezier curve from A on the held back segment over the corner to B on the new segment.
+// All four axes follow the curve with the same parameter and A and B cut both segments at the same 
+// fraction in both planes, so both wire ends stay synchronized. The distance of the cut from the 
+// corner is chosen for a deviation of at most the path tolerance in both planes, but never more 
+// than the held back segment or half of the new segment. Sends the held back segment up to B to the 
+// merge stage and returns true, or returns false if the corner is not rounded.
+static uint8_t mc_blend_corner(float *target)
+{
+  float d1[N_AXIS], d2[N_AXIS];
+  uint8_t idx;
+  for (idx=0; idx<N_AXIS; idx++) {
+    d1[idx] = blend.corner[idx] - blend.start[idx];
+    d2[idx] = target[idx] - blend.corner[idx];
+  }
+  float l1 = mc_segment_length(d1);
+  float l2 = mc_segment_length(d2);
+  if ((l1 == 0.0) || (l2 == 0.0)) { return(false); }
+
+  // Change of the direction vectors over the corner, the larger of both planes. The deviation of
+  // the curve from the corner is cut*du/4.
+  float u[N_AXIS];
+  for (idx=0; idx<N_AXIS; idx++) { u[idx] = d2[idx]/l2 - d1[idx]/l1; }
+#ifdef FOAM_CUTTER
+  float du = max(sqrt(u[X_AXIS]*u[X_AXIS] + u[Y_AXIS]*u[Y_AXIS]), sqrt(u[U_AXIS]*u[U_AXIS] + u[Z_AXIS]*u[Z_AXIS]));
+#else
+  float du = mc_segment_length(u);
+#endif
+  if (du >= 2.0) { return(false); }                   // Reversal, no rounding possible
+
+  // Corners the planner passes at the feed rate anyway are not rounded. Junction speed of the 
+  // planner by the trig half angle identity, du = 2*cos(theta/2), with the acceleration of the new 
+  // segment limited by the axis accelerations like in plan_buffer_line().
+  float sin_theta_d2 = sqrt(1.0 - 0.25*du*du);
+  if (sin_theta_d2 >= 1.0) { return(false); }
+  float acceleration = settings.acceleration;
+  for (idx=0; idx<N_AXIS; idx++) {
+    if (d2[idx] != 0.0) {
+      acceleration = min(acceleration, settings.axis_acceleration[idx]*fabs(l2/d2[idx]));
+    }
+  }
+  if (acceleration*settings.junction_deviation*sin_theta_d2/(1.0-sin_theta_d2) >=
+      blend.feed_rate*blend.feed_rate) { return(false); }
+
+  float cut = min(4.0*blend_tolerance/du, min(l1, 0.5*l2));
+  float a[N_AXIS], b[N_AXIS], q[N_AXIS];
+  for (idx=0; idx<N_AXIS; idx++) {
+    a[idx] = blend.corner[idx] - d1[idx]*cut/l1;
+    b[idx] = blend.corner[idx] + d2[idx]*cut/l2;
+  }
+  if (cut < l1) {
+    mc_merge_line(a[X_AXIS], a[Y_AXIS], a[U_AXIS], a[Z_AXIS], blend.feed_rate, false, C_LINE, blend.tool_state, blend.tool_pwr);
+  }
+  uint8_t k;
+  for (k=1; k<=PATH_BLEND_SEGMENTS; k++) {
+    float t = (float)k/PATH_BLEND_SEGMENTS;
+    for (idx=0; idx<N_AXIS; idx++) {
+      q[idx] = (1.0-t)*(1.0-t)*a[idx] + 2.0*t*(1.0-t)*blend.corner[idx] + t*t*b[idx];
+    }
+    mc_merge_line(q[X_AXIS], q[Y_AXIS], q[U_AXIS], q[Z_AXIS], blend.feed_rate, false, C_LINE, blend.tool_state, blend.tool_pwr);
+    if (sys.abort) { return(true); }
+  }
+  memcpy(blend.start, b, sizeof(b));
+  return(true);
+}
+#endif
+
+
+// Sets the path control mode. With a tolerance > 0 the corners between line segments are rounded 
+// within the tolerance in mm (G64), with 0 the exact path is followed (G61).
+void mc_set_path_tolerance(float tolerance)
+{
+#ifdef PATH_BLENDING
+  blend_tolerance = tolerance;
+#endif
+}
+
+
+void mc_init()
+{
+  memset(&mc_stats, 0, sizeof(mc_stats));
+#ifdef LINE_MERGE
+  merge.count = 0;
+#endif
+#ifdef PATH_BLENDING
+  blend.pending = false;
+  blend_tolerance = 0.0;
+#endif
+}
+
+
+void mc_line_flush()
+{
+#ifdef PATH_BLENDING
+  mc_blend_flush();
+#endif
+  mc_merge_flush();
+  // A dry run executes all blocks, the callers wait for the planner to run empty
+  if (sys.state == STATE_DRY_RUN) {
+    while (plan_get_current_block()) { mc_dry_run_advance(true); }
+    dry_run_ahead = min(dry_run_ahead, 0.0);
+  }
+}
+
+
+void mc_line_idle()
+{
+  // A dry run reads the lines faster than the stepper, held back segments wait for the next line
+  if (sys.state == STATE_DRY_RUN) { return; }
+#ifdef PATH_BLENDING
+  if (blend.pending) {
+    if ((plan_get_current_block() == NULL) || (sys_millis() - blend.time >= PATH_BLEND_TIMEOUT)) {
+      mc_line_flush();
+    }
+  }
+#endif
+#ifdef LINE_MERGE
+  if (merge.count) {
+    if ((plan_get_current_block() == NULL) || (sys_millis() - merge.time >= LINE_MERGE_TIMEOUT)) {
+      mc_line_flush();
+    }
+  }
+#endif
+}
+
+
+uint8_t mc_dry_run_begin()
+{
+  mc_line_flush();                // Nothing of the current job may be held back
+  if (sys.state != STATE_IDLE) { return(false); }
+  memcpy(&dry_run_gc, &gc, sizeof(gc));
+  dry_run_auto_start = sys.auto_start;
+  memset(&estimate, 0, sizeof(estimate));
+  dwell_run = 0.0;
+  dry_run_ahead = 0.0;
+  dry_run_micros = sys_micros();
+  sys.state = STATE_DRY_RUN;
+  return(true);
+}
+
+
+void mc_dry_run_end(mc_estimate_t *result)
+{
+  if (sys.state != STATE_DRY_RUN) { return; }  // Ended by a system reset
+  mc_line_flush();                // Execute the remaining blocks
+  memcpy(result, &estimate, sizeof(estimate));
+
+  // Back to the parser and planner state before the dry run
+  memcpy(&gc, &dry_run_gc, sizeof(gc));
+  mc_set_path_tolerance((gc.path_mode == PATH_MODE_BLEND) ? gc.path_tolerance : 0.0);
+  int32_t position[N_AXIS];
+  st_get_position(position);
+  plan_set_current_position(position[X_AXIS], position[Y_AXIS], position[U_AXIS], position[Z_AXIS]);
+  sys.auto_start = dry_run_auto_start;
+  sys.state = STATE_IDLE;
+}
+
+
+// Execute linear motion in absolute millimeter coordinates. Feed rate given in millimeters/second
+// unless invert_feed_rate is true. Then the feed_rate means that the motion should be completed in
+// (1 minute)/feed_rate time.
+// NOTE: This is the primary gateway to the grbl planner. All line motions, including arc line
+// segments, must pass through this routine before being passed to the planner. The seperation of
+// mc_line and plan_buffer_line is done primarily to make backlash compensation integration simple
+// and direct.
+// TODO: Check for a better way to avoid having to push the arguments twice for non-backlash cases.
+// However, this keeps the memory requirements lower since it doesn't have to call and hold two
+// plan_buffer_lines in memory. Grbl only has to retain the original line input variables during a
+// backlash segment(s).
+/// 8c1
+
+// With PATH_BLENDING in continuous path mode (G64) the segment is held back to round the corner to
+// the following segment. With LINE_MERGE the segment may be held back and merged with the following
+// segments into one planner block. See mc_line_flush().
+/// 8c1
+
+void mc_line(float x, float y, float u, float z, float feed_rate, uint8_t invert_feed_rate, uint8_t t_curve, int8_t tool_state, float tool_pwr)
+{
+  // TODO: Perform soft limit check here. Just check if the target x,y,z values are outside the
+  // work envelope. Should be straightforward and efficient. By placing it here, rather than in
+  // the g-code parser, it directly picks up motions from everywhere in Grbl.
+
+  // If in check gcode mode, prevent motion by blocking planner.
+  if (sys.state == STATE_CHECK_MODE) { return; }
+
+#ifdef PATH_BLENDING
+  float target[N_AXIS];
+  target[X_AXIS] = x;
+  target[Y_AXIS] = y;
+  target[U_AXIS] = u;
+  target[Z_AXIS] = z;
+  
+  // Only line segments with the same tool settings are rounded. Arcs are smooth already and the 
+  // time of inverse time motions is given by the gcode.
+  uint8_t blending = ((blend_tolerance > 0.0) && (!invert_feed_rate) && (t_curve == C_LINE));
+  
+  if (blend.pending) {
+    if (!blending || (tool_state != blend.tool_state) || (tool_pwr != blend.tool_pwr) ||
+        !mc_blend_corner(target)) {
+      mc_blend_flush();
+    }
+    if (sys.abort) { return; }
+  }
+  
+  if (blending) {
+    // Hold the segment back until the next segment shows how to round its end.
+    if (!blend.pending) { mc_merge_position(blend.start); }
+    memcpy(blend.corner, target, sizeof(target));
+    blend.feed_rate   = feed_rate;
+    blend.tool_state  = tool_state;
+    blend.tool_pwr    = tool_pwr;
+    blend.time        = sys_millis();
+    blend.pending     = true;
+    return;
+  }
+#endif
+
+  mc_merge_line(x, y, u, z, feed_rate, invert_feed_rate, t_curve, tool_state, tool_pwr);
+}
+
+
+// Circle plane of an arc, traced by mc_arc() with successive rotations of the radius vector
+typedef struct {
+  uint8_t axis_0, axis_1;           // Axes of the plane
+  float center_axis0, center_axis1; // Circle center
+  float offset_axis0, offset_axis1; // Offset from the start to the center
+  float r_axis0, r_axis1;           // Radius vector from center to current location
+  float theta_per_segment;          // Angular travel of a segment
+  float cos_T, sin_T;               // Vector rotation matrix values
+} mc_arc_plane_t;
+
+
+// Initializes a circle plane of an arc and returns its angular travel.
+static float mc_arc_plane_init(mc_arc_plane_t *plane, float *position, float *target, float *offset,
+  uint8_t axis_0, uint8_t axis_1, uint8_t isclockwise)
 {
-  float center_axis0 = position[axis_0] + offset[axis_0];
-  float center_axis1 = position[axis_1] + offset[axis_1];
-  float linear_travel = target[axis_linear] - position[axis_linear];
-  float r_axis0 = -offset[axis_0];  // Radius vector from center to current location
-  float r_axis1 = -offset[axis_1];
-  float rt_axis0 = target[axis_0] - center_axis0;
-  float rt_axis1 = target[axis_1] - center_axis1;
+  plane->axis_0 = axis_0;
+  plane->axis_1 = axis_1;
+  plane->offset_axis0 = offset[axis_0];
+  plane->offset_axis1 = offset[axis_1];
+  plane->center_axis0 = position[axis_0] + offset[axis_0];
+  plane->center_axis1 = position[axis_1] + offset[axis_1];
+  plane->r_axis0 = -offset[axis_0];
+  plane->r_axis1 = -offset[axis_1];
+  float rt_axis0 = target[axis_0] - plane->center_axis0;
+  float rt_axis1 = target[axis_1] - plane->center_axis1;
 
   // CCW angle between position and target from circle center. Only one atan2() trig computation required.
-  float angular_travel = atan2(r_axis0*rt_axis1-r_axis1*rt_axis0, r_axis0*rt_axis0+r_axis1*rt_axis1);
+  float angular_travel = atan2(plane->r_axis0*rt_axis1-plane->r_axis1*rt_axis0, 
+                               plane->r_axis0*rt_axis0+plane->r_axis1*rt_axis1);
   if (isclockwise) { // Correct atan2 output per direction
     if (angular_travel >= 0) { angular_travel -= 2*M_PI; }
   } else {
     if (angular_travel <= 0) { angular_travel += 2*M_PI; }
   }
+  return(angular_travel);
+}
+
+
+// Sets the segment count of a circle plane and the rotation matrix for one segment.
+static void mc_arc_plane_segments(mc_arc_plane_t *plane, float angular_travel, uint16_t segments)
+{
+  plane->theta_per_segment = angular_travel/segments;
+  plane->cos_T = 1-0.5*plane->theta_per_segment*plane->theta_per_segment; // Small angle approximation
+  plane->sin_T = plane->theta_per_segment;
+}
+
+
+// Rotates the radius vector of a circle plane to segment i and sets the plane axes of arc_target. With
+// correction the exact location is computed from the initial radius vector.
+static void mc_arc_plane_rotate(mc_arc_plane_t *plane, uint16_t i, uint8_t correction, float *arc_target)
+{
+  if (!correction) {
+    // Apply vector rotation matrix
+    float r_axisi = plane->r_axis0*plane->sin_T + plane->r_axis1*plane->cos_T;
+    plane->r_axis0 = plane->r_axis0*plane->cos_T - plane->r_axis1*plane->sin_T;
+    plane->r_axis1 = r_axisi;
+  } else {
+    // Arc correction to radius vector. Computed only every n_arc_correction increments.
+    // Compute exact location by applying transformation matrix from initial radius vector(=-offset).
+    float cos_Ti = cos(i*plane->theta_per_segment);
+    float sin_Ti = sin(i*plane->theta_per_segment);
+    plane->r_axis0 = -plane->offset_axis0*cos_Ti + plane->offset_axis1*sin_Ti;
+    plane->r_axis1 = -plane->offset_axis0*sin_Ti - plane->offset_axis1*cos_Ti;
+  }
+  arc_target[plane->axis_0] = plane->center_axis0 + plane->r_axis0;
+  arc_target[plane->axis_1] = plane->center_axis1 + plane->r_axis1;
+}
+
+
+// Execute an arc in offset mode format. position == current position, target == target position,
+// offset == offset from current position to the circle centers, axis_XXX defines circle plane in 
+// tool space, isclockwise boolean. Used for vector transformation direction. With uz_arc the UZ 
+// plane follows a second arc around its own center (offset[U_AXIS], offset[Z_AXIS]) in the same 
+// direction. All other axes travel linearly (helical travel). 
+// The arc is approximated by generating a number of linear segments. The chords of the segments 
+// deviate at most settings.arc_tolerance from the arc, so the segments grow with the radius. Both 
+// planes and the linear axes share the segments, each segment covers the same fraction of every 
+// plane, so both wire ends stay synchronized. The tighter plane gives the number of segments.
+// Segments are at least settings.mm_per_arc_segment long. While the planner buffer runs low, they 
+// are at least as long as the wire travels in PLANNER_MIN_SEGMENT_TIME, so the planner is not 
+// drained by the segments of small radii (the deviation may exceed the tolerance then).
+void mc_arc(float *position, float *target, float *offset, uint8_t axis_0, uint8_t axis_1,
+  uint8_t uz_arc, float feed_rate, uint8_t invert_feed_rate, uint8_t isclockwise, int8_t tool_state, float tool_pwr)
+{
+  mc_arc_plane_t plane[2];
+  float angular_travel[2];
+  uint8_t planes = 1;
+  angular_travel[0] = mc_arc_plane_init(&plane[0], position, target, offset, axis_0, axis_1, isclockwise);
+  if (uz_arc) {
+    angular_travel[1] = mc_arc_plane_init(&plane[1], position, target, offset, U_AXIS, Z_AXIS, isclockwise);
+    planes = 2;
+  }
+
+  // Number of segments for the chord tolerance. A chord of angle theta deviates r*(1-cos(theta/2))
+  // from the arc. At least three segments for a full circle.
+  float arc_travel = 0;
+  float segments_tolerance = 1;
+  uint8_t idx;
+  for (idx=0; idx<planes; idx++) {
+    float radius = hypot(offset[plane[idx].axis_0], offset[plane[idx].axis_1]);
+    float cos_half_theta = max(0.5, 1.0-settings.arc_tolerance/radius);
+    segments_tolerance = max(segments_tolerance, fabs(angular_travel[idx])/(2*acos(cos_half_theta)));
+    arc_travel = max(arc_travel, fabs(angular_travel[idx])*radius);
+  }
+  float linear_travel[N_AXIS];
+  float linear_mm = 0;
+  for (idx=0; idx<N_AXIS; idx++) {
+    linear_travel[idx] = target[idx] - position[idx];
+  }
+  for (idx=0; idx<planes; idx++) {
+    linear_travel[plane[idx].axis_0] = 0;
+    linear_travel[plane[idx].axis_1] = 0;
+  }
+  for (idx=0; idx<N_AXIS; idx++) {
+    linear_mm += linear_travel[idx]*linear_travel[idx];
+  }
 
-  float millimeters_of_travel = hypot(angular_travel*radius, fabs(linear_travel));
+  float millimeters_of_travel = hypot(arc_travel, sqrt(linear_mm));
   if (millimeters_of_travel == 0.0) { return; }
-  uint16_t segments = floor(millimeters_of_travel/settings.mm_per_arc_segment);
+  
+  // The minimum segment length caps the number of segments.
+  float min_segment = settings.mm_per_arc_segment;
+  #ifdef PLANNER_SLOWDOWN
+    if (!invert_feed_rate && (plan_blocks_queued() < BLOCK_BUFFER_SIZE/2)) {
+      min_segment = max(min_segment, feed_rate*(PLANNER_MIN_SEGMENT_TIME/60000000.0));
+    }
+  #endif
+  uint16_t segments = max(1, min(ceil(segments_tolerance), floor(millimeters_of_travel/min_segment)));
+  
+  // Update the performance counters
+  mc_stats.arcs++;
+  mc_stats.arc_segments += segments;
+  mc_stats.arc_segments_fixed += max(1, floor(millimeters_of_travel/settings.mm_per_arc_segment));
+
   // Multiply inverse feed_rate to compensate for the fact that this movement is approximated
   // by a number of discrete segments. The inverse feed_rate should be correct for the sum of
   // all segments.
   if (invert_feed_rate) { feed_rate *= segments; }
 
-  float theta_per_segment = angular_travel/segments;
-  float linear_per_segment = linear_travel/segments;
-
   /* Vector rotation by transformation matrix: r is the original vector, r_T is the rotated vector,
      and phi is the angle of rotation. Solution approach by Jens Geisler.
          r_T = [cos(phi) -sin(phi);
@@ -132,66 +741,139 @@ void mc_arc(float *position, float *target, float *offset, uint8_t axis_0, uint8
      a correction, the planner should have caught up to the lag caused by the initial mc_arc overhead.
      This is important when there are successive arc motions.
   */
-  // Vector rotation matrix values
-  float cos_T = 1-0.5*theta_per_segment*theta_per_segment; // Small angle approximation
-  float sin_T = theta_per_segment;
-/// 8c1  no U_AXIS
-  float arc_target[3];
-  float sin_Ti;
-  float cos_Ti;
-  float r_axisi;
+  for (idx=0; idx<planes; idx++) {
+    mc_arc_plane_segments(&plane[idx], angular_travel[idx], segments);
+  }
+
+  float arc_target[N_AXIS];
   uint16_t i;
   int8_t count = 0;
 
-  // Initialize the linear axis
-  arc_target[axis_linear] = position[axis_linear];
+  // Initialize the linear axes
+  memcpy(arc_target, position, sizeof(arc_target));
+  for (idx=0; idx<N_AXIS; idx++) {
+    linear_travel[idx] /= segments;
+  }
 
   for (i = 1; i<segments; i++) { // Increment (segments-1)
-
-    if (count < settings.n_arc_correction) {
-      // Apply vector rotation matrix
-      r_axisi = r_axis0*sin_T + r_axis1*cos_T;
-      r_axis0 = r_axis0*cos_T - r_axis1*sin_T;
-      r_axis1 = r_axisi;
-      count++;
-    } else {
-      // Arc correction to radius vector. Computed only every n_arc_correction increments.
-      // Compute exact location by applying transformation matrix from initial radius vector(=-offset).
-      cos_Ti = cos(i*theta_per_segment);
-      sin_Ti = sin(i*theta_per_segment);
-      r_axis0 = -offset[axis_0]*cos_Ti + offset[axis_1]*sin_Ti;
-      r_axis1 = -offset[axis_0]*sin_Ti - offset[axis_1]*cos_Ti;
-      count = 0;
-    }
+    uint8_t correction = (count >= settings.n_arc_correction);
+    if (correction) { count = 0; } else { count++; }
 
     // Update arc_target location
-    arc_target[axis_0] = center_axis0 + r_axis0;
-    arc_target[axis_1] = center_axis1 + r_axis1;
-    arc_target[axis_linear] += linear_per_segment;
-/// 8c1  -> 0 for U_AXIS  and  arc = true   // TODO ?!?!?
-  mc_line(arc_target[X_AXIS], arc_target[Y_AXIS], arc_target[U_AXIS], arc_target[Z_AXIS], feed_rate, invert_feed_rate, C_ARC, tool_state, tool_pwr);
+    for (idx=0; idx<planes; idx++) {
+      mc_arc_plane_rotate(&plane[idx], i, correction, arc_target);
+    }
+    for (idx=0; idx<N_AXIS; idx++) {
+      arc_target[idx] += linear_travel[idx];
+    }
+    mc_line(arc_target[X_AXIS], arc_target[Y_AXIS], arc_target[U_AXIS], arc_target[Z_AXIS], feed_rate, invert_feed_rate, C_ARC, tool_state, tool_pwr);
 
     // Bail mid-circle on system abort. Runtime command check already performed by mc_line.
     if (sys.abort) { return; }
   }
   // Ensure last segment arrives at target location.
-/// 8c1 -> 0 for U_AXIS  and  arc // TODO ?!?!?
-   mc_line(target[X_AXIS], target[Y_AXIS], arc_target[U_AXIS], target[Z_AXIS], feed_rate, invert_feed_rate, C_ARC, tool_state, tool_pwr) ;
+  mc_line(target[X_AXIS], target[Y_AXIS], target[U_AXIS], target[Z_AXIS], feed_rate, invert_feed_rate, C_ARC, tool_state, tool_pwr);
 }
 
 
+#ifdef LASER_RASTER
+void mc_raster(float x, float y, float u, float z, float feed_rate, uint8_t invert_feed_rate, int8_t tool_state,
+  float tool_pwr, uint8_t *pwr, uint8_t count)
+{
+  // If in check gcode mode, prevent motion by blocking planner.
+  if (sys.state == STATE_CHECK_MODE) { return; }
+
+  // Segments held back for blending or merging come first
+  mc_line_flush();
+
+  float position[N_AXIS];
+  float delta[N_AXIS];
+  plan_get_position(position);
+  delta[X_AXIS] = x - position[X_AXIS];
+  delta[Y_AXIS] = y - position[Y_AXIS];
+  delta[Z_AXIS] = z - position[Z_AXIS];
+  delta[U_AXIS] = u - position[U_AXIS];
+
+  float step_events = 0.0;
+  uint8_t idx;
+  for (idx=0; idx<N_AXIS; idx++) {
+    step_events = max(step_events, fabs(delta[idx])*settings.steps_per_mm[idx]);
+  }
+
+  // A pixel needs at least one step event, finer pixels are dropped
+  if (step_events < count) {
+    uint8_t pixels = max(1, step_events);
+    for (idx=0; idx<pixels; idx++) { pwr[idx] = pwr[(uint16_t)idx*count/pixels]; }
+    count = pixels;
+  }
+
+  // Lines longer than a block are split like in mc_buffer_line(), each part gets its share of pixels
+  uint16_t parts = 1;
+  if (step_events > BLOCK_MAX_STEP_EVENTS) { parts = ceil(step_events/BLOCK_MAX_STEP_EVENTS); }
+  if (invert_feed_rate) { feed_rate *= parts; }
+  uint16_t part;
+  for (part=1; part<=parts; part++) {
+    uint8_t first = min(count-1, (uint32_t)(part-1)*count/parts);
+    uint8_t pixels = max(1, (uint32_t)part*count/parts - first);
+    
+    // Wait for room in the planner and in the raster buffer
+    while (true) {
+      if (!mc_wait_for_block()) { return; }
+      if (plan_buffer_raster(pwr+first, pixels)) { break; }
+      // A dry run frees the pixels by waiting for the running block, the stepper would do so
+      if (sys.state == STATE_DRY_RUN) { mc_dry_run_advance(true); }
+    }
+    if (part < parts) {
+      float fraction = (float)part/parts;
+      plan_buffer_line(position[X_AXIS]+fraction*delta[X_AXIS], position[Y_AXIS]+fraction*delta[Y_AXIS],
+                       position[U_AXIS]+fraction*delta[U_AXIS], position[Z_AXIS]+fraction*delta[Z_AXIS],
+                       feed_rate, invert_feed_rate, C_LINE, tool_state, tool_pwr);
+    } else {
+      plan_buffer_line(x, y, u, z, feed_rate, invert_feed_rate, C_LINE, tool_state, tool_pwr);
+    }
+    mc_cycle_start();
+  }
+}
+#endif
+
+
 // Execute dwell in seconds.
-void mc_dwell(float seconds)
+void mc_dwell(float seconds, int8_t tool_state, float tool_pwr)
+{
+  // If in check gcode mode, prevent the dwell by blocking planner.
+  if (sys.state == STATE_CHECK_MODE) { return; }
+
+  // Segments held back for blending or merging come first
+  mc_line_flush();
+
+  // Dwells longer than a block are split. A zero dwell still queues one block for the tool state.
+  uint32_t milliseconds = lround(1000*seconds);
+  do {
+    uint16_t block_ms = min(milliseconds, BLOCK_MAX_STEP_EVENTS);
+    if (!mc_wait_for_block()) { return; }
+    plan_buffer_dwell(block_ms, tool_state, tool_pwr);
+    mc_cycle_start();
+    milliseconds -= min(milliseconds, block_ms);
+  } while (milliseconds > 0);
+}
+
+
+// Execute a tool change [M3,M4,M5]. Axis are not moved, so the change is queued as a dwell without
+// time. The stepper switches the tool after the motions before, while the parser keeps filling the
+// buffer. Switching off does not wait for a cycle start, if no cycle runs or the buffer is empty. The
+// tool goes off at once, queued motions switch it on again with their blocks. The dwell is only queued
+// for them. During a feed hold the block in execution keeps the tool on.
+void mc_tool(int8_t tool_state, float tool_pwr)
 {
-   uint16_t i = floor(1000/DWELL_TIME_STEP*seconds);
-   plan_synchronize();
-   delay_ms(floor(1000*seconds-i*DWELL_TIME_STEP)); // Delay millisecond remainder
-   while (i-- > 0) {
-     // NOTE: Check and execute runtime commands during dwell every <= DWELL_TIME_STEP milliseconds.
-     protocol_execute_runtime();
-     if (sys.abort) { return; }
-     _delay_ms(DWELL_TIME_STEP); // Delay DWELL_TIME_STEP increment
-   }
+  if (sys.state == STATE_CHECK_MODE) { return; }
+
+  if ((tool_state != 3) && (tool_state != 4)) {
+    mc_line_flush();
+    uint8_t blocks_queued = plan_blocks_queued();
+    if ((blocks_queued == 0) || ((sys.state != STATE_CYCLE) && (sys.state != STATE_HOLD))) { tool_off(); }
+    if (blocks_queued == 0) { return; }
+  }
+  mc_dwell(0, tool_state, tool_pwr);
 }
 
 
@@ -200,6 +882,7 @@ void mc_dwell(float seconds)
 // executing the homing cycle. This prevents incorrect buffered plans after homing.
 void mc_go_home()
 {
+  mc_line_flush();                // Nothing may be held back for merging
   sys.state = STATE_HOMING;       // Set system state variable
   limits_disable();               // Disable the limits
   
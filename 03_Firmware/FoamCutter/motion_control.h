@@ -4,21 +4,80 @@
 #include <avr/io.h>
 #include "planner.h"
 
+// Arc performance counters, cleared by mc_init() and reported with $P
+typedef struct {
+  uint32_t arcs;                      // Number of arcs traced
+  uint32_t arc_segments;              // Sum of the line segments of all arcs
+  uint32_t arc_blocks;                // Sum of the planner blocks of all arcs, more if segments are split
+  uint32_t arc_segments_fixed;        // Sum of the line segments with the fixed length of $11
+} mc_statistics_t;
+extern mc_statistics_t mc_stats;
+
+// Job time estimate of a dry run, see mc_dry_run_begin()
+typedef struct {
+  float cut_time;                     // Time of the motions with the tool on in sec
+  float travel_time;                  // Time of the motions with the tool off in sec
+  float dwell_time;                   // Time of the dwells and tool changes in sec
+  float stall_time;                   // Longest standstill of consecutive dwells in sec
+  uint32_t blocks;                    // Number of executed planner blocks
+} mc_estimate_t;
+
 // Execute linear motion in absolute millimeter coordinates. Feed rate given in millimeters/second
 // unless invert_feed_rate is true. Then the feed_rate means that the motion should be completed in
 // (1 minute)/feed_rate time.
 /// 8c1
 void mc_line(float x, float y, float u, float z, float feed_rate, uint8_t invert_feed_rate, uint8_t t_curve, int8_t tool_state, float tool_pwr);
 
-// Execute an arc in offset mode format. position == current xyz, target == target xyz,
-// offset == offset from current xyz, axis_XXX defines circle plane in tool space, axis_linear is
-// the direction of helical travel, radius == circle radius, isclockwise boolean. Used
-// for vector transformation direction.
+// Initialize motion control, discards segments held back for blending or merging and selects the 
+// exact path mode
+void mc_init();
+
+// Sets the path control mode. Tolerance in mm for continuous path mode (G64), 0 for exact path 
+// mode (G61).
+void mc_set_path_tolerance(float tolerance);
+
+// Sends segments held back for blending or merging to the planner. Must be called before waiting
+// for the planner to finish all blocks.
+void mc_line_flush();
+
+// Called from the main loop. Sends segments held back for blending or merging to the planner, if 
+// the planner runs empty or no further segment arrived within PATH_BLEND_TIMEOUT/LINE_MERGE_TIMEOUT.
+void mc_line_idle();
+
+// Starts a dry run ($E and the job estimate of the sd card). The g-code is parsed and planned as 
+// usual, but instead of stepping, each block is discarded as soon as the stepper would start it on 
+// a clock of the parse time and the block times. Its execution time is taken from its trapezoid. 
+// Returns false, if the system is not idle.
+uint8_t mc_dry_run_begin();
+
+// Ends the dry run and returns the estimate. The parser and planner state before the dry run are 
+// restored, the machine did not move.
+void mc_dry_run_end(mc_estimate_t *result);
+
+// Execute an arc in offset mode format. position == current position, target == target position,
+// offset == offset from current position to the circle centers, axis_XXX defines circle plane in 
+// tool space, isclockwise boolean. Used for vector transformation direction. With uz_arc the UZ 
+// plane follows a second arc around (offset[U_AXIS], offset[Z_AXIS]), synchronized with the first.
+// All other axes travel linearly.
 void mc_arc(float *position, float *target, float *offset, uint8_t axis_0, uint8_t axis_1,
-  uint8_t axis_linear, float feed_rate, uint8_t invert_feed_rate, float radius, uint8_t isclockwise, int8_t tool_state, float tool_pwr);
+  uint8_t uz_arc, float feed_rate, uint8_t invert_feed_rate, uint8_t isclockwise, int8_t tool_state, float tool_pwr);
+
+#ifdef LASER_RASTER
+// Execute a raster line, a linear motion with the power of count pixels spread evenly along the line
+// (0...TOOL_PWR_MAX). The line is never blended or merged, so it runs at a constant speed, if the
+// motions before and after accelerate and decelerate in line with it (overscan).
+void mc_raster(float x, float y, float u, float z, float feed_rate, uint8_t invert_feed_rate, int8_t tool_state,
+  float tool_pwr, uint8_t *pwr, uint8_t count);
+#endif
+
+// Queues a dwell for a specific number of seconds in the planner buffer. The stepper executes the 
+// dwell in order with the motions and sets the tool state at its start. A dwell of 0 seconds queues 
+// a tool change (M3, M4, M5) without waiting for the motions before.
+void mc_dwell(float seconds, int8_t tool_state, float tool_pwr);
 
-// Dwell for a specific number of seconds
-void mc_dwell(float seconds);
+// Queues a tool change (M3, M4, M5) as a dwell of 0 seconds. The tool is switched off at once, if no
+// motion is pending or no cycle runs.
+void mc_tool(int8_t tool_state, float tool_pwr);
 
 // Perform homing cycle to locate machine zero. Requires limit switches.
 void mc_go_home();
@@ -1,7 +1,9 @@
 #include <util/delay.h>
+#include <avr/interrupt.h>
 #include "nuts_bolts.h"
 #include "gcode.h"
 #include "planner.h"
+#include "stepper.h"
 
 // Bit field and masking macros
 #define bit(n) (1 << n) 
@@ -128,10 +130,109 @@ void delay_us(uint32_t us)
   }
 }
 
+// Milliseconds since sys_tick_init(). Only written by the timer 0 compare interrupt.
+static volatile uint32_t sys_tick_ms;
+
+// Timer 0 is not used otherwise (the Arduino core init() is never called). Run it in CTC mode
+// with a 1/64 prescaler, so it counts in 4 usec steps and fires the compare interrupt every 1 msec.
+void sys_tick_init()
+{
+  sys_tick_ms = 0;
+  TCCR0A = (1<<WGM01);              // CTC mode, top = OCR0A
+  TCCR0B = (1<<CS01) | (1<<CS00);   // 1/64 prescaler
+  OCR0A  = (F_CPU/64/1000) - 1;     // 250 counts = 1 msec
+  TCNT0  = 0;
+  TIMSK0 |= (1<<OCIE0A);
+}
+
+ISR(TIMER0_COMPA_vect)
+{
+  sys_tick_ms++;
+}
+
+uint32_t sys_millis()
+{
+  uint8_t sreg = SREG;
+  cli();
+  uint32_t ms = sys_tick_ms;
+  SREG = sreg;
+  return(ms);
+}
+
+uint32_t sys_micros()
+{
+  uint8_t sreg = SREG;
+  cli();
+  uint32_t ms = sys_tick_ms;
+  uint8_t ticks = TCNT0;
+  // Compare match occured, but the interrupt has not been serviced yet.
+  if ((TIFR0 & (1<<OCF0A)) && (ticks < OCR0A)) { ms++; }
+  SREG = sreg;
+  return(ms*1000 + ticks*(64/(F_CPU/1000000)));
+}
+
+// Integer square root, rounded down. Computes one bit of the root per iteration with shifts and
+// subtractions only, which is much faster than the float sqrt() on the AVR.
+uint16_t isqrt(uint32_t x)
+{
+  uint32_t root = 0;
+  uint32_t bit = 1UL << 30;
+  while (bit > x) { bit >>= 2; }
+  while (bit) {
+    if (x >= root+bit) {
+      x -= root+bit;
+      root = (root >> 1)+bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return(root);
+}
+
+
+// Heap start and end of avr-libc. __brkval is 0 until the heap is used.
+extern uint8_t __heap_start;
+extern uint8_t *__brkval;
+#define RAM_PATTERN 0xA5
+
+static uint8_t *sys_heap_end()
+{
+  if (__brkval == 0) { return(&__heap_start); }
+  return(__brkval);
+}
+
+// Paints the RAM below the stack pointer. Keeps a few bytes clear for the interrupts.
+void sys_ram_init()
+{
+  uint8_t *p = sys_heap_end();
+  uint8_t *sp = (uint8_t *)SP - 16;
+  while (p < sp) { *p++ = RAM_PATTERN; }
+}
+
+uint16_t sys_ram_free()
+{
+  return((uint8_t *)SP - sys_heap_end());
+}
+
+// The stack overwrites the pattern from the top of the RAM downwards, the heap from its start upwards.
+// The pattern left in between is the RAM never used.
+uint16_t sys_ram_unused()
+{
+  uint8_t *p = sys_heap_end();
+  uint8_t *sp = (uint8_t *)SP;
+  uint16_t unused = 0;
+  while ((p < sp) && (*p == RAM_PATTERN)) { p++; unused++; }
+  return(unused);
+}
+
+
 // Syncs all internal position vectors to the current system position.
 void sys_sync_current_position()
 {
 /// 8c1
-  plan_set_current_position(sys.position[X_AXIS],sys.position[Y_AXIS], sys.position[U_AXIS], sys.position[Z_AXIS]);
-  gc_set_current_position(sys.position[X_AXIS],sys.position[Y_AXIS], sys.position[U_AXIS],sys.position[Z_AXIS]);
+  int32_t position[N_AXIS];
+  st_get_position(position);
+  plan_set_current_position(position[X_AXIS], position[Y_AXIS], position[U_AXIS], position[Z_AXIS]);
+  gc_set_current_position(position[X_AXIS], position[Y_AXIS], position[U_AXIS], position[Z_AXIS]);
 }
@@ -60,6 +60,17 @@
 #define EXEC_CRIT_EVENT     bit(6) // bitmask 01000000
 // #define                  bit(7) // bitmask 10000000
 
+// Define override flag bit map. Set by the serial interrupt for the override characters, executed
+// by protocol_execute_runtime().
+#define OVR_FEED_RESET          bit(0)
+#define OVR_FEED_COARSE_PLUS    bit(1)
+#define OVR_FEED_COARSE_MINUS   bit(2)
+#define OVR_FEED_FINE_PLUS      bit(3)
+#define OVR_FEED_FINE_MINUS     bit(4)
+#define OVR_TOOL_RESET          bit(5)
+#define OVR_TOOL_COARSE_PLUS    bit(6)
+#define OVR_TOOL_COARSE_MINUS   bit(7)
+
 // Define system state bit map. The state variable primarily tracks the individual functions
 // of Grbl to manage each without overlapping. It is also used as a messaging flag for
 // critical events.
@@ -72,16 +83,20 @@
 #define STATE_ALARM      6 // In alarm state. Locks out all g-code processes. Allows settings access.
 #define STATE_CHECK_MODE 7 // G-code check mode. Locks out planner and motion only.
 // #define STATE_JOG     8 // Jogging mode is unique like homing.
+#define STATE_DRY_RUN    9 // Job time estimate. Plans the g-code, but discards the blocks without motion.
 
 // Define global system variables
 typedef struct {
   uint8_t abort;                 // System abort flag. Forces exit back to main loop for reset.
   uint8_t state;                 // Tracks the current state of Grbl.
   volatile uint8_t execute;      // Global system runtime executor bitflag variable. See EXEC bitmasks.
-  int32_t position[4];      // Real-time machine (aka home) position vector in steps.
-                                 // NOTE: This may need to be a volatile variable, if problems arise.
+  int32_t position[4];           // Machine (aka home) position vector in steps at the start of the block in
+                                 // execution. The real-time position is read with st_get_position().
   uint8_t auto_start;            // Planner auto-start flag. Toggled off during feed hold. Defaulted by settings.
   uint8_t err;                   // error Code
+  volatile uint8_t override;     // Override flag byte. See OVR bitmasks.
+  uint8_t feed_override;         // Feed override in %, applied to the planned blocks
+  uint8_t tool_override;         // Tool power override in %
 } system_t;
 extern system_t sys;
 
@@ -108,6 +123,28 @@ void delay_ms(uint16_t ms);
 // Delays variable-defined microseconds. Compiler compatibility fix for _delay_us().
 void delay_us(uint32_t us);
 
+// Starts the millisecond system tick on timer 0. Used for throughput statistics and timeouts.
+void sys_tick_init();
+
+// Returns the milliseconds since sys_tick_init(). Wraps after ~49 days.
+uint32_t sys_millis();
+
+// Returns the microseconds since sys_tick_init() with a resolution of 4 usec. Wraps after ~71 minutes.
+uint32_t sys_micros();
+
+// Integer square root, rounded down.
+uint16_t isqrt(uint32_t x);
+
+// Fills the free RAM between the heap and the stack with a pattern for sys_ram_unused(). Called once
+// at startup.
+void sys_ram_init();
+
+// Returns the bytes of RAM between the end of the heap and the stack pointer.
+uint16_t sys_ram_free();
+
+// Returns the bytes of RAM between the end of the heap and the deepest stack since sys_ram_init().
+uint16_t sys_ram_unused();
+
 // Syncs Grbl's gcode and planner position variables with the system position.
 void sys_sync_current_position();
 
@@ -11,11 +11,35 @@
 #include "protocol.h"
 
 #include "gcode.h"  /// to_degrees()
+#include "motion_control.h"
+#include "tool.h"           // TOOL_PWR_MAX
 
 static block_t block_buffer[BLOCK_BUFFER_SIZE];  // A ring buffer for motion instructions
 static volatile uint8_t block_buffer_head;       // Index of the next block to be pushed
 static volatile uint8_t block_buffer_tail;       // Index of the block to process now
 static uint8_t next_buffer_head;                 // Index of the next buffer head
+static volatile uint8_t block_buffer_planned;    // Index of the last optimally planned block. Blocks from 
+                                                 // the tail up to this block are not replanned anymore.
+
+plan_statistics_t plan_stats;                    // Planner performance counters
+
+#ifdef PLANNER_FIXED_POINT
+// Unit vectors with 14 fraction bits and their cosines with 28 fraction bits for the junction speed
+typedef int16_t unit_t;
+typedef int32_t cosine_t;
+#define UNIT_ONE   16384.0
+#define COSINE(c)  ((cosine_t)((c)*268435456.0))
+typedef struct {
+  uint16_t root;                  // Root of acceleration*junction_deviation, normalized to 16 bits
+  uint8_t shift;                  // Fraction bits of the root in mm/min
+} junction_t;
+#else
+typedef float unit_t;
+typedef float cosine_t;
+#define UNIT_ONE   1.0
+#define COSINE(c)  (c)
+typedef float junction_t;         // Acceleration*junction_deviation in (mm/min)^2
+#endif
 
 // Define planner variables
 typedef struct {
@@ -23,11 +47,36 @@ typedef struct {
   int32_t position[N_AXIS];             // The planner position of the tool in absolute steps. Kept separate
                                    // from g-code position for movements requiring multiple line motions,
                                    // i.e. arcs, canned cycles, and backlash compensation.
-  float previous_unit_vec[N_AXIS];     // Unit vector of previous path line segment
+  unit_t previous_unit_vec[N_AXIS];    // Unit vector of previous path line segment
   float previous_nominal_speed;   // Nominal speed of previous path line segment
+#ifdef FOAM_CUTTER
+  float previous_plane_ratio[2];  // Travel of the XY / UZ plane relative to the previous block millimeters
+#endif
+#ifdef PLANNER_SLOWDOWN
+  float segment_time;             // Moving average of the time of the new blocks at their feed rate in usec
+#endif
+#ifdef LASER_RASTER
+  uint8_t *raster;                // Pixels stored by plan_buffer_raster() for the next block
+  uint8_t raster_count;
+#endif
 } planner_t;
 static planner_t pl;
 
+#ifdef LASER_RASTER
+  #if RASTER_BUFFER_SIZE < LINE_BUFFER_SIZE
+    #error "RASTER_BUFFER_SIZE must hold at least the pixels of two lines"
+  #endif
+// Ring buffer of the raster pixels. The pixels of a block are stored in one piece, if they do not fit 
+// at the end of the buffer, they start at the beginning. Blocks free their pixels in order.
+typedef struct {
+  uint8_t buffer[RASTER_BUFFER_SIZE];
+  uint16_t head;                  // Index after the pixels of the last block
+  volatile uint16_t tail;         // Index of the pixels of the oldest block, moved by the stepper
+  volatile uint8_t blocks;        // Number of blocks with pixels not executed yet
+} raster_t;
+static raster_t raster;
+#endif
+
 // Returns the index of the next block in the ring buffer
 // NOTE: Removed modulo (%) operator, which uses an expensive divide and multiplication.
 static uint8_t next_block_index(uint8_t block_index)
@@ -47,6 +96,89 @@ static uint8_t prev_block_index(uint8_t block_index)
 }
 
 
+// Returns the number of blocks in the ring buffer
+uint8_t plan_blocks_queued()
+{
+  uint8_t head = block_buffer_head;
+  uint8_t tail = block_buffer_tail;
+  if (head >= tail) { return(head - tail); }
+  return(BLOCK_BUFFER_SIZE - tail + head);
+}
+
+
+// Returns the execution time of a planned block in seconds. The ramps of the trapezoid are taken
+// as constant acceleration from the rate at their start to the rate at their end, the stepper
+// never runs slower than MINIMUM_STEPS_PER_MINUTE. A dwell block lasts one msec per step event.
+float plan_block_time(block_t *block)
+{
+  if (block->flags & BLOCK_FLAG_DWELL) { return(block->step_event_count/1000.0); }
+  float acceleration = (float)block->rate_delta*(60*ACCELERATION_TICKS_PER_SECOND); // (step/min^2)
+  float initial_rate = max(block->initial_rate, MINIMUM_STEPS_PER_MINUTE);
+  float final_rate = max(block->final_rate, MINIMUM_STEPS_PER_MINUTE);
+  float accelerate_steps = block->accelerate_until;
+  float plateau_steps = block->decelerate_after - block->accelerate_until;
+  float decelerate_steps = block->step_event_count - block->decelerate_after;
+  // Rate at the end of the acceleration, below the nominal rate for a triangle profile
+  float cruise_rate = min(block->nominal_rate, sqrt(initial_rate*initial_rate + 2*acceleration*accelerate_steps));
+  float minutes = 0.0;
+  if (accelerate_steps > 0) { minutes += 2*accelerate_steps/(initial_rate + cruise_rate); }
+  if (plateau_steps > 0) { minutes += plateau_steps/block->nominal_rate; }
+  if (decelerate_steps > 0) {
+    float end_rate = cruise_rate*cruise_rate - 2*acceleration*decelerate_steps;
+    end_rate = (end_rate > final_rate*final_rate) ? sqrt(end_rate) : final_rate;
+    minutes += 2*decelerate_steps/(cruise_rate + end_rate);
+  }
+  return(minutes*60);
+}
+
+
+#ifdef PLANNER_FIXED_POINT
+// Returns the maximum allowable speed at the entry of the block, when the block must reach target_velocity
+// at its exit using the block acceleration. Integer version of max_allowable_speed(), rounded down.
+static uint16_t block_allowable_speed(block_t *block, uint16_t target_velocity)
+{
+  uint32_t v2 = (uint32_t)target_velocity*target_velocity;
+  if (v2 > 0xFFFFFFFF-block->delta_v2) { return(BLOCK_MAX_SPEED); }
+  return( isqrt(v2+block->delta_v2) );
+}
+
+
+// Returns steps*num/den, at most steps. Both 32 bit operands are scaled down until the product fits
+// into 32 bit. The relative error is below 2^-15, less than 2 step events for the longest block.
+static uint16_t step_fraction(uint16_t steps, uint32_t num, uint32_t den, uint8_t round_up)
+{
+  if (num >= den) { return(steps); }
+  while (den > 0xFFFF) { num >>= 1; den >>= 1; }
+  uint32_t product = (uint32_t)steps*num;
+  if (round_up) { product += den-1; }
+  return(product/den);
+}
+
+
+// Returns rate*speed/nominal_speed rounded down. speed must not exceed nominal_speed, the rate must be
+// below 2^24 steps/min (far beyond the stepper interrupt limit).
+static uint32_t scale_rate(uint32_t rate, uint16_t speed, uint16_t nominal_speed)
+{
+  uint32_t factor = ((uint32_t)speed << 16)/nominal_speed;  // 0...1 with 16 bit fraction
+  return( (((rate >> 8)*factor) >> 8) + (((rate & 0xFF)*factor) >> 16) );
+}
+
+#else
+// Nominal speed of the block in mm/min, derived from the nominal step rate.
+static float block_nominal_speed(block_t *block)
+{
+  return( (block->millimeters*block->nominal_rate)/block->step_event_count );
+}
+
+
+// Acceleration of the block in mm/min^2, derived from the step rate change per acceleration tick. This is
+// exactly the acceleration the stepper interrupt executes.
+static float block_acceleration(block_t *block)
+{
+  return( (block->millimeters*block->rate_delta*(60*ACCELERATION_TICKS_PER_SECOND))/block->step_event_count );
+}
+
+
 // Calculates the distance (not time) it takes to accelerate from initial_rate to target_rate using the
 // given acceleration:
 static float estimate_acceleration_distance(float initial_rate, float target_rate, float acceleration)
@@ -85,6 +217,114 @@ static float max_allowable_speed(float acceleration, float target_velocity, floa
 }
 
 
+// Returns the maximum allowable speed at the entry of the block, when the block must reach target_velocity
+// at its exit using the block acceleration. Rounded down to whole mm/min.
+static uint16_t block_allowable_speed(block_t *block, uint16_t target_velocity)
+{
+  return( min(BLOCK_MAX_SPEED,
+    max_allowable_speed(-block_acceleration(block),target_velocity,block->millimeters)) );
+}
+#endif
+
+
+// Returns the nominal speed of the block in whole mm/min
+static uint16_t block_speed(block_t *block)
+{
+  #ifdef PLANNER_FIXED_POINT
+    return(block->nominal_speed);
+  #else
+    return( min(BLOCK_MAX_SPEED, block_nominal_speed(block)) );
+  #endif
+}
+
+
+// Returns the maximum allowable entry speed of the current block, the junction speed limited by the
+// nominal speeds of both blocks at the junction. The nominal speeds change with the feed override, so
+// the limit is not stored in the block. previous is NULL, if the block before is discarded already.
+static uint16_t block_max_entry_speed(block_t *previous, block_t *current)
+{
+  uint16_t max_entry_speed = current->max_junction_speed;
+  if (max_entry_speed == 0) { return(0); }    // Dwell, first block or junction to a dwell
+  max_entry_speed = min(max_entry_speed, block_speed(current));
+  if (previous) { max_entry_speed = min(max_entry_speed, block_speed(previous)); }
+  return(max_entry_speed);
+}
+
+
+// Computes the maximum junction speed for the angle between the previous and the current path.
+// cos_theta is the negative cosine of the angle, -1 for a straight junction and 1 for a reversal.
+// NOTE: Max junction velocity is computed without sin() or acos() by trig half angle identity.
+static float junction_speed(cosine_t cos_theta, junction_t factor, float vmax_junction)
+{
+  // Skip and use minimum planner speed for 0 degree acute junction.
+  if (cos_theta >= COSINE(0.95)) { return(MINIMUM_PLANNER_SPEED); }
+  // Skip and avoid divide by zero for straight junctions at 180 degrees. Limit to min() of nominal speeds.
+  if (cos_theta > COSINE(-0.95)) {
+    // Compute maximum junction velocity based on maximum acceleration and junction deviation
+  #ifdef PLANNER_FIXED_POINT
+    // sin(theta/2) with 15 bit fraction by the trig half angle identity. 1-sin(theta/2) is replaced by
+    // 0.5*(1+cos_theta)/(1+sin(theta/2)) to avoid the loss of precision for nearly straight junctions.
+    // The ratio sin(theta/2)/(1-sin(theta/2)) gets 15 fraction bits, it is at most 80 in this range.
+    // The junction velocity is the root of the factor times the root of the ratio, with 2 fraction bits.
+    uint16_t sin_theta_d2 = isqrt(((uint32_t)((1L << 28) - cos_theta)) << 1);
+    uint32_t ratio = ((((uint32_t)sin_theta_d2*((1UL << 15)+sin_theta_d2)) >> 14) << 15)
+                       / ((uint32_t)((1L << 28) + cos_theta) >> 13);
+    uint32_t v4 = ((uint32_t)factor.root*isqrt(ratio << 9)) >> (factor.shift+10);
+    vmax_junction = min(vmax_junction, 0.25*v4);
+  #else
+    float sin_theta_d2 = sqrt(0.5*(1.0-cos_theta)); // Trig half angle identity. Always positive.
+    vmax_junction = min(vmax_junction, sqrt(factor * sin_theta_d2/(1.0-sin_theta_d2)) );
+  #endif
+  }
+  return(vmax_junction);
+}
+
+
+// Returns the acceleration times the junction deviation of a block for junction_speed(). The fixed
+// point factor is its square root, normalized to 16 bits with the shift to mm/min.
+static junction_t junction_factor(float acceleration)
+{
+  float factor = acceleration * settings.junction_deviation;
+#ifdef PLANNER_FIXED_POINT
+  junction_t root;
+  uint32_t factor_int;
+  root.shift = 0;
+  if (factor < 16777216.0) { factor_int = factor*256; root.shift = 4; }   // 8 fraction bits
+  else { factor_int = min(4294967295.0, factor); }
+  while ((factor_int > 0) && (factor_int < (1UL << 30))) { factor_int <<= 2; root.shift++; }
+  root.root = isqrt(factor_int);
+  return(root);
+#else
+  return(factor);
+#endif
+}
+
+
+#ifdef FOAM_CUTTER
+// Junction speed of one plane (XY or UZ tower) of the foam cutter. Both towers pass the junction at
+// the same time, but each with its own direction and its own share of the block speed. The junction
+// speed is computed from the angle in the plane and scaled from plane speed to block speed with the
+// larger share of both blocks. A tower starting or stopping at the junction changes its velocity
+// by the full plane speed, the same change as for a 60 degree corner, so it is planned like one.
+static float plane_junction_speed(uint8_t axis_0, uint8_t axis_1, unit_t *unit_vec, float plane_ratio,
+                                  uint8_t plane, junction_t factor, float vmax_junction)
+{
+  float prev_ratio = pl.previous_plane_ratio[plane];
+  
+  if ((prev_ratio == 0.0) && (plane_ratio == 0.0)) { return(vmax_junction); } // Tower not moving
+  
+  cosine_t cos_theta = COSINE(-0.5);            // Tower starts or stops
+  if ((prev_ratio > 0.0) && (plane_ratio > 0.0)) {
+    cos_theta = - (cosine_t)pl.previous_unit_vec[axis_0] * unit_vec[axis_0]
+                - (cosine_t)pl.previous_unit_vec[axis_1] * unit_vec[axis_1];
+  }
+  
+  float max_ratio = max(prev_ratio, plane_ratio);
+  return( junction_speed(cos_theta, factor, vmax_junction*max_ratio) / max_ratio );
+}
+#endif
+
+
 // The kernel called by planner_recalculate() when scanning the plan from last to first entry.
 static void planner_reverse_pass_kernel(block_t *previous, block_t *current, block_t *next)
 {
@@ -94,17 +334,18 @@ static void planner_reverse_pass_kernel(block_t *previous, block_t *current, blo
     // If entry speed is already at the maximum entry speed, no need to recheck. Block is cruising.
     // If not, block in state of acceleration or deceleration. Reset entry speed to maximum and
     // check for maximum allowable speed reductions to ensure maximum possible planned speed.
-    if (current->entry_speed != current->max_entry_speed) {
+    uint16_t max_entry_speed = block_max_entry_speed(previous, current);
+    if (current->entry_speed != max_entry_speed) {
 
       // If nominal length true, max junction speed is guaranteed to be reached. Only compute
       // for max allowable speed if block is decelerating and nominal length is false.
-      if ((!current->nominal_length_flag) && (current->max_entry_speed > next->entry_speed)) {
-        current->entry_speed = min( current->max_entry_speed,
-          max_allowable_speed(-settings.acceleration,next->entry_speed,current->millimeters));
+      if (!(current->flags & BLOCK_FLAG_NOMINAL_LENGTH) && (max_entry_speed > next->entry_speed)) {
+        current->entry_speed = min( max_entry_speed,
+          block_allowable_speed(current,next->entry_speed) );
       } else {
-        current->entry_speed = current->max_entry_speed;
+        current->entry_speed = max_entry_speed;
       }
-      current->recalculate_flag = true;
+      current->flags |= BLOCK_FLAG_RECALCULATE;
 
     }
   } // Skip last block. Already initialized and set for recalculation.
@@ -112,61 +353,68 @@ static void planner_reverse_pass_kernel(block_t *previous, block_t *current, blo
 
 
 // planner_recalculate() needs to go over the current plan twice. Once in reverse and once forward. This
-// implements the reverse pass.
+// implements the reverse pass. It stops at the last optimally planned block, all blocks before can't
+// be changed anymore by any new block.
 static void planner_reverse_pass()
 {
   uint8_t block_index = block_buffer_head;
   block_t *block[3] = {NULL, NULL, NULL};
-  while(block_index != block_buffer_tail) {
+  while(block_index != block_buffer_planned) {
     block_index = prev_block_index( block_index );
     block[2]= block[1];
     block[1]= block[0];
     block[0] = &block_buffer[block_index];
     planner_reverse_pass_kernel(block[0], block[1], block[2] );
+    plan_stats.blocks_replanned++;
   }
-  // Skip buffer tail/first block to prevent over-writing the initial entry speed.
+  // Skip the planned block (initially the buffer tail) to prevent over-writing its entry speed.
 }
 
 
 // The kernel called by planner_recalculate() when scanning the plan from first to last entry.
-static void planner_forward_pass_kernel(block_t *previous, block_t *current, block_t *next)
+// Returns true, if the entry speed of the current block is optimal and can't be changed anymore.
+static uint8_t planner_forward_pass_kernel(block_t *previous, block_t *current)
 {
-  if(!previous) { return; }  // Begin planning after buffer_tail
-
   // If the previous block is an acceleration block, but it is not long enough to complete the
   // full speed change within the block, we need to adjust the entry speed accordingly. Entry
   // speeds have already been reset, maximized, and reverse planned by reverse planner.
   // If nominal length is true, max junction speed is guaranteed to be reached. No need to recheck.
-  if (!previous->nominal_length_flag) {
+  if (!(previous->flags & BLOCK_FLAG_NOMINAL_LENGTH)) {
     if (previous->entry_speed < current->entry_speed) {
-      float entry_speed = min( current->entry_speed,
-        max_allowable_speed(-settings.acceleration,previous->entry_speed,previous->millimeters) );
+      uint16_t entry_speed = min( current->entry_speed,
+        block_allowable_speed(previous,previous->entry_speed) );
 
-      // Check for junction speed change
+      // Check for junction speed change. The entry speed is now limited by the acceleration of the
+      // previous block, which is already optimal. No new block can increase it anymore.
       if (current->entry_speed != entry_speed) {
         current->entry_speed = entry_speed;
-        current->recalculate_flag = true;
+        current->flags |= BLOCK_FLAG_RECALCULATE;
+        return(true);
       }
     }
   }
+  // A block entering with its maximum junction speed is optimal, too. New blocks can only increase
+  // the exit speed of the last block, so this entry speed will never be reduced.
+  return(current->entry_speed == block_max_entry_speed(previous, current));
 }
 
 
 // planner_recalculate() needs to go over the current plan twice. Once in reverse and once forward. This
-// implements the forward pass.
+// implements the forward pass beginning at the last optimally planned block. Each block found to be
+// optimal moves the planned pointer forward.
 static void planner_forward_pass()
 {
-  uint8_t block_index = block_buffer_tail;
-  block_t *block[3] = {NULL, NULL, NULL};
+  uint8_t block_index = block_buffer_planned;
+  block_t *previous;
+  block_t *current = &block_buffer[block_index];
 
+  block_index = next_block_index( block_index );
   while(block_index != block_buffer_head) {
-    block[0] = block[1];
-    block[1] = block[2];
-    block[2] = &block_buffer[block_index];
-    planner_forward_pass_kernel(block[0],block[1],block[2]);
+    previous = current;
+    current = &block_buffer[block_index];
+    if (planner_forward_pass_kernel(previous, current)) { block_buffer_planned = block_index; }
     block_index = next_block_index( block_index );
   }
-  planner_forward_pass_kernel(block[1], block[2], NULL);
 }
 
 
@@ -178,12 +426,76 @@ static void planner_forward_pass()
                                    +-------------+
                                        time -->
 */
-// Calculates trapezoid parameters so that the entry- and exit-speed is compensated by the provided factors.
-// The factors represent a factor of braking and must be in the range 0.0-1.0.
+#ifdef S_CURVE_ACCELERATION
+// Calculates the number of acceleration ticks of the acceleration and the deceleration ramp from the
+// cruise rate, the nominal rate or the peak rate of a triangle profile. The stepper runs the S-curve
+// ramps in the same time as the linear ramps, so they cover the same number of step events.
+static void calculate_ramp_ticks(block_t *block, uint32_t cruise_rate)
+{
+  cruise_rate = max(cruise_rate, max(block->initial_rate, block->final_rate));
+  block->accelerate_ticks = min(0xFFFF, (cruise_rate-block->initial_rate+block->rate_delta-1)/block->rate_delta);
+  block->decelerate_ticks = min(0xFFFF, (cruise_rate-block->final_rate+block->rate_delta-1)/block->rate_delta);
+}
+#endif
+
+
+// Calculates trapezoid parameters for the given entry and exit speed of the block. The speeds must not
+// exceed the nominal speed of the block.
 // This converts the planner parameters to the data required by the stepper controller.
 // NOTE: Final rates must be computed in terms of their respective blocks.
-static void calculate_trapezoid_for_block(block_t *block, float entry_factor, float exit_factor)
+#ifdef PLANNER_FIXED_POINT
+// The integer version works on the squares of the speeds. The travel to change the speed from v0 to v1
+// is (v1^2-v0^2)/(2*acceleration), relative to the block this is (v1^2-v0^2)/delta_v2.
+static void calculate_trapezoid_for_block(block_t *block, uint16_t entry_speed, uint16_t exit_speed)
 {
+  uint16_t steps = block->step_event_count;
+  uint32_t nominal_v2 = (uint32_t)block->nominal_speed*block->nominal_speed;
+  uint32_t entry_v2 = (uint32_t)entry_speed*entry_speed;
+  uint32_t exit_v2 = (uint32_t)exit_speed*exit_speed;
+
+  block->initial_rate = scale_rate(block->nominal_rate, entry_speed, block->nominal_speed); // (step/min)
+  block->final_rate = scale_rate(block->nominal_rate, exit_speed, block->nominal_speed); // (step/min)
+  uint16_t accelerate_steps = step_fraction(steps, nominal_v2-entry_v2, block->delta_v2, true);
+  uint16_t decelerate_steps = step_fraction(steps, nominal_v2-exit_v2, block->delta_v2, false);
+  uint16_t plateau_steps = 0;
+
+  if ((uint32_t)accelerate_steps+decelerate_steps <= steps) {
+    plateau_steps = steps-accelerate_steps-decelerate_steps;
+  } else {
+    // No cruising. Accelerate until the intersection point, the half of delta_v2-entry_v2+exit_v2.
+    uint32_t intersection_v2 = block->delta_v2 >> 1;
+    if (exit_v2 >= entry_v2) {
+      intersection_v2 += (exit_v2-entry_v2) >> 1;
+    } else if ((entry_v2-exit_v2) >> 1 < intersection_v2) {
+      intersection_v2 -= (entry_v2-exit_v2) >> 1;
+    } else {
+      intersection_v2 = 0;
+    }
+    accelerate_steps = step_fraction(steps, intersection_v2, block->delta_v2, true);
+  }
+
+  block->accelerate_until = accelerate_steps;
+  block->decelerate_after = accelerate_steps+plateau_steps;
+
+  #ifdef S_CURVE_ACCELERATION
+    uint32_t cruise_rate = block->nominal_rate;
+    if (plateau_steps == 0) {
+      // Triangle profile. Peak speed at the intersection point, entry_v2 plus the share of delta_v2.
+      uint32_t accelerate_v2 = (block->delta_v2/steps)*accelerate_steps +
+                               ((block->delta_v2%steps)*accelerate_steps)/steps;
+      if (accelerate_v2 < nominal_v2-entry_v2) {
+        cruise_rate = scale_rate(block->nominal_rate, isqrt(entry_v2+accelerate_v2), block->nominal_speed);
+      }
+    }
+    calculate_ramp_ticks(block, cruise_rate);
+  #endif
+}
+#else
+static void calculate_trapezoid_for_block(block_t *block, uint16_t entry_speed, uint16_t exit_speed)
+{
+  float nominal_speed = block_nominal_speed(block);
+  float entry_factor = entry_speed/nominal_speed;
+  float exit_factor = exit_speed/nominal_speed;
   block->initial_rate = ceil(block->nominal_rate*entry_factor); // (step/min)
   block->final_rate = ceil(block->nominal_rate*exit_factor); // (step/min)
   int32_t acceleration_per_minute = block->rate_delta*ACCELERATION_TICKS_PER_SECOND*60.0; // (step/min^2)
@@ -208,7 +520,18 @@ static void calculate_trapezoid_for_block(block_t *block, float entry_factor, fl
 
   block->accelerate_until = accelerate_steps;
   block->decelerate_after = accelerate_steps+plateau_steps;
+
+  #ifdef S_CURVE_ACCELERATION
+    uint32_t cruise_rate = block->nominal_rate;
+    if (plateau_steps == 0) {
+      // Triangle profile. Peak rate at the intersection point.
+      cruise_rate = min(cruise_rate, sqrt((float)block->initial_rate*block->initial_rate +
+                                          2.0*acceleration_per_minute*accelerate_steps));
+    }
+    calculate_ramp_ticks(block, cruise_rate);
+  #endif
 }
+#endif
 
 /*                            PLANNER SPEED DEFINITION
                                      +--------+   <- current->nominal_speed
@@ -222,31 +545,31 @@ static void calculate_trapezoid_for_block(block_t *block, float entry_factor, fl
 // entry_speed for each junction and the entry_speed of the next junction. Must be called by
 // planner_recalculate() after updating the blocks. Any recalulate flagged junction will
 // compute the two adjacent trapezoids to the junction, since the junction speed corresponds
-// to exit speed and entry speed of one another.
-static void planner_recalculate_trapezoids()
+// to exit speed and entry speed of one another. Blocks before the planned block have unchanged
+// entry and exit speeds, so the scan starts there.
+static void planner_recalculate_trapezoids(uint8_t block_index)
 {
-  uint8_t block_index = block_buffer_tail;
   block_t *current;
   block_t *next = NULL;
 
   while(block_index != block_buffer_head) {
     current = next;
     next = &block_buffer[block_index];
-    if (current) {
+    if (current && !(current->flags & BLOCK_FLAG_DWELL)) {
       // Recalculate if current block entry or exit junction speed has changed.
-      if (current->recalculate_flag || next->recalculate_flag) {
-        // NOTE: Entry and exit factors always > 0 by all previous logic operations.
-        calculate_trapezoid_for_block(current, current->entry_speed/current->nominal_speed,
-          next->entry_speed/current->nominal_speed);
-        current->recalculate_flag = false; // Reset current only to ensure next trapezoid is computed
+      if ((current->flags | next->flags) & BLOCK_FLAG_RECALCULATE) {
+        calculate_trapezoid_for_block(current, current->entry_speed, next->entry_speed);
+        current->flags &= ~BLOCK_FLAG_RECALCULATE; // Reset current only to ensure next trapezoid is computed
       }
     }
     block_index = next_block_index( block_index );
   }
   // Last/newest block in buffer. Exit speed is set with MINIMUM_PLANNER_SPEED. Always recalculated.
-  calculate_trapezoid_for_block(next, next->entry_speed/next->nominal_speed,
-    MINIMUM_PLANNER_SPEED/next->nominal_speed);
-  next->recalculate_flag = false;
+  // Dwell blocks keep their constant rate.
+  if (!(next->flags & BLOCK_FLAG_DWELL)) {
+    calculate_trapezoid_for_block(next, next->entry_speed, MINIMUM_PLANNER_SPEED);
+  }
+  next->flags &= ~BLOCK_FLAG_RECALCULATE;
 }
 
 // Recalculates the motion plan according to the following algorithm:
@@ -267,35 +590,64 @@ static void planner_recalculate_trapezoids()
 //   3. Recalculate trapezoids for all blocks using the recently updated junction speeds. Block trapezoids
 //      with no updated junction speeds will not be recalculated and assumed ok as is.
 //
+// Blocks with an optimal entry speed (limited by the full acceleration of an optimal predecessor or at 
+// their maximum junction speed) can't be changed by any new block. block_buffer_planned points to the
+// last of them and all passes only work on the blocks behind it. For a stream of short segments this
+// reduces the work per new block from the whole buffer to the few blocks which can still change.
+//
 // All planner computations are performed with doubles (float on Arduinos) to minimize numerical round-
 // off errors. Only when planned values are converted to stepper rate parameters, these are integers.
+// Junction speeds are stored in whole mm/min, always rounded down, so the plan stays on the safe side.
 
 static void planner_recalculate()
 {
+  uint8_t block_index = block_buffer_planned;   // Trapezoids are recalculated from the old planned block
+
   planner_reverse_pass();
   planner_forward_pass();
-  planner_recalculate_trapezoids();
+  planner_recalculate_trapezoids(block_index);
 }
 
 void plan_reset_buffer()
 {
   block_buffer_tail = block_buffer_head;
+  block_buffer_planned = block_buffer_head;
   next_buffer_head = next_block_index(block_buffer_head);
+  #ifdef LASER_RASTER
+    raster.head = 0;
+    raster.tail = 0;
+    raster.blocks = 0;
+  #endif
 }
 
 void plan_init()
 {
   plan_reset_buffer();
   memset(&pl, 0, sizeof(pl)); // Clear planner struct
+  memset(&plan_stats, 0, sizeof(plan_stats)); // Clear performance counters
 }
 
 void plan_discard_current_block()
 {
   if (block_buffer_head != block_buffer_tail) {
-    block_buffer_tail = next_block_index( block_buffer_tail );
+    uint8_t block_index = next_block_index( block_buffer_tail );
+    // Push the planned pointer forward with the tail, it must never point to a discarded block.
+    if (block_buffer_tail == block_buffer_planned) { block_buffer_planned = block_index; }
+    block_buffer_tail = block_index;
   }
 }
 
+#ifdef LASER_RASTER
+void plan_discard_raster(uint8_t *pixels, uint8_t count)
+{
+  uint8_t sreg = SREG;
+  cli();
+  raster.tail = (pixels - raster.buffer) + count;
+  raster.blocks--;
+  SREG = sreg;
+}
+#endif
+
 block_t *plan_get_current_block()
 {
   if (block_buffer_head == block_buffer_tail) { return(NULL); }
@@ -313,6 +665,7 @@ uint8_t plan_check_full_buffer()
 // during a synchronize call, if it should happen. Also, waits for clean cycle end.
 void plan_synchronize()
 {
+  mc_line_flush();              // Send a segment held back for merging
   while (plan_get_current_block() || sys.state == STATE_CYCLE) {
     protocol_execute_runtime();   // Check and execute run-time commands
     if (sys.abort) { return; } // Check for system abort
@@ -320,6 +673,97 @@ void plan_synchronize()
 }
 
 
+#ifdef LASER_RASTER
+uint8_t plan_buffer_raster(uint8_t *pwr, uint8_t count)
+{
+  uint8_t sreg = SREG;
+  cli();
+  uint16_t tail = raster.tail;
+  uint8_t blocks = raster.blocks;
+  SREG = sreg;
+
+  uint16_t start = raster.head;
+  if (blocks == 0) {
+    start = 0;                                    // Buffer empty
+  } else if (start >= tail) {
+    if (start + count > RASTER_BUFFER_SIZE) {     // No room at the end, start at the beginning
+      if (count >= tail) { return(false); }
+      start = 0;
+    }
+  } else if (start + count >= tail) {
+    return(false);
+  }
+  memcpy(&raster.buffer[start], pwr, count);
+  pl.raster = &raster.buffer[start];
+  pl.raster_count = count;
+  return(true);
+}
+#endif
+
+
+// Returns the tool power in % scaled to 0...TOOL_PWR_MAX. The stepper interrupt sets the pwm of a block
+// without float math.
+static uint8_t block_tool_pwr(float tool_pwr)
+{
+  if (tool_pwr >= 100.0) { return(TOOL_PWR_MAX); }
+  if (tool_pwr > 0.0) { return(tool_pwr*(TOOL_PWR_MAX/100.0) + 0.5); }
+  return(0);
+}
+
+
+// Add a dwell block to the buffer. The block runs one step event per msec without steps at a constant
+// rate. Entry and maximum entry speed are zero, so the passes leave it alone and plan the motion before
+// to a stop, the motion after starts from rest like the first block. The rate_delta equals the rate,
+// so a feed hold stops the dwell at the next event and plan_cycle_reinitialize() resumes the rest.
+void plan_buffer_dwell(uint16_t milliseconds, int8_t tool_state, float tool_pwr)
+{
+  block_t *block = &block_buffer[block_buffer_head];
+
+  // Keep the direction pins of the last block, the ring buffer still holds it.
+  block->direction_bits = block_buffer[prev_block_index(block_buffer_head)].direction_bits;
+  block->steps_x = 0;
+  block->steps_y = 0;
+  block->steps_z = 0;
+  block->steps_u = 0;
+  block->step_event_count = max(1, min(BLOCK_MAX_STEP_EVENTS, milliseconds));
+  block->tool_state = tool_state;
+  block->tool_pwr = block_tool_pwr(tool_pwr);
+  #ifdef LASER_RASTER
+    block->raster_count = 0;
+  #endif
+
+  block->entry_speed = 0;
+  block->max_junction_speed = 0;
+  block->feed_override = 100;
+  block->flags = BLOCK_FLAG_DWELL | BLOCK_FLAG_NOMINAL_LENGTH;
+  #ifdef PLANNER_FIXED_POINT
+    block->nominal_speed = 1;
+    block->delta_v2 = 0;
+  #else
+    block->millimeters = 0.0;
+  #endif
+  block->nominal_rate = BLOCK_DWELL_RATE;
+  block->initial_rate = BLOCK_DWELL_RATE;
+  block->final_rate = BLOCK_DWELL_RATE;
+  block->rate_delta = BLOCK_DWELL_RATE;
+  block->accelerate_until = 0;
+  block->decelerate_after = block->step_event_count;
+  #ifdef S_CURVE_ACCELERATION
+    block->accelerate_ticks = 0;
+    block->decelerate_ticks = 0;
+  #endif
+
+  // The next motion starts from rest
+  pl.previous_nominal_speed = 0.0;
+
+  block_buffer_head = next_buffer_head;
+  next_buffer_head = next_block_index(block_buffer_head);
+
+  // Plan the motion before the dwell to a stop
+  planner_recalculate();
+}
+
+
 // Add a new linear movement to the buffer. x, y, u and z is the signed, absolute target position in
 // millimeters. Feed rate specifies the speed of the motion. If feed rate is inverted, the feed
 // rate is taken to mean "frequency" and would complete the operation in 1/feed_rate minutes.
@@ -356,7 +800,13 @@ void plan_buffer_line(float x, float y, float u, float z, float feed_rate, uint8
   block->step_event_count = max(block->steps_x, max(block->steps_y, max(block->steps_z, block->steps_u)));
 
   block->tool_state       = tool_state;
-  block->tool_pwr         = tool_pwr;
+  block->tool_pwr         = block_tool_pwr(tool_pwr);
+  #ifdef LASER_RASTER
+    // The block takes the pixels of plan_buffer_raster(), a zero-length block drops them
+    block->raster           = pl.raster;
+    block->raster_count     = pl.raster_count;
+    pl.raster_count         = 0;
+  #endif
   
   // Bail if this is a zero-length block
   if (block->step_event_count == 0)
@@ -373,14 +823,13 @@ void plan_buffer_line(float x, float y, float u, float z, float feed_rate, uint8
 /// <--
   // SKW
   #ifdef FOAM_CUTTER
-    block->millimeters = sqrt(max((delta_mm[X_AXIS]*delta_mm[X_AXIS]
-                                 + delta_mm[Y_AXIS]*delta_mm[Y_AXIS]
-                              ),
-                             (delta_mm[Z_AXIS]*delta_mm[Z_AXIS]
-                               + delta_mm[U_AXIS]*delta_mm[U_AXIS]
-                              )));
+    // The wire moves along two planes, XY and UZ. The block length is the travel of the longer one.
+    float plane_mm[2];
+    plane_mm[0] = sqrt(delta_mm[X_AXIS]*delta_mm[X_AXIS] + delta_mm[Y_AXIS]*delta_mm[Y_AXIS]);
+    plane_mm[1] = sqrt(delta_mm[Z_AXIS]*delta_mm[Z_AXIS] + delta_mm[U_AXIS]*delta_mm[U_AXIS]);
+    float millimeters = max(plane_mm[0], plane_mm[1]);
   #else
-    block->millimeters = sqrt(delta_mm[X_AXIS]*delta_mm[X_AXIS]
+    float millimeters = sqrt(delta_mm[X_AXIS]*delta_mm[X_AXIS]
                               + delta_mm[Y_AXIS]*delta_mm[Y_AXIS]
                               + delta_mm[Z_AXIS]*delta_mm[Z_AXIS]
                               + delta_mm[U_AXIS]*delta_mm[U_AXIS]
@@ -388,7 +837,7 @@ void plan_buffer_line(float x, float y, float u, float z, float feed_rate, uint8
     //block->millimeters += labs(delta_mm[U_AXIS]);
   #endif
 
-  float inverse_millimeters = 1.0/block->millimeters;  // Inverse millimeters to remove multiple divides
+  float inverse_millimeters = 1.0/millimeters;  // Inverse millimeters to remove multiple divides
 
   // Calculate speed in mm/minute for each axis. No divide by zero due to previous checks.
   // NOTE: Minimum stepper speed is limited by MINIMUM_STEPS_PER_MINUTE in stepper.c
@@ -400,8 +849,45 @@ void plan_buffer_line(float x, float y, float u, float z, float feed_rate, uint8
     inverse_minute = /* 1.0 / if feedrate is G93 it is already inverted!!!*/ feed_rate;
   }
   
-  block->nominal_speed = block->millimeters * inverse_minute; // (mm/min) Always > 0
+  // Limit the nominal speed and the acceleration of the block to the axis limits. An axis moving
+  // delta_mm for the block millimeters runs at nominal_speed*delta_mm/millimeters, so each axis
+  // limit is scaled by millimeters/delta_mm to the block. The slowest axis limits the block.
+  // The feed override scales the programmed speed up to the axis limits. The block keeps the override
+  // it follows to rescale its rates, if the override changes. See plan_set_feed_override().
+  float feed_speed = millimeters * inverse_minute;
+  float speed_limit = feed_speed*2.55;                     // Override limit of 255%
+  float acceleration = settings.acceleration;              // Path acceleration is the upper limit
+  uint8_t idx;
+  for (idx=0; idx<N_AXIS; idx++) {
+    if (delta_mm[idx] != 0.0) {
+      float inverse_axis_ratio = fabs(millimeters/delta_mm[idx]);
+      speed_limit = min(speed_limit, settings.max_rate[idx]*inverse_axis_ratio);
+      acceleration = min(acceleration, settings.axis_acceleration[idx]*inverse_axis_ratio);
+    }
+  }
+  uint8_t override_limit = max(1, floor(100.0*speed_limit/feed_speed));
+  block->feed_override = min(sys.feed_override, override_limit);
+  speed_limit = feed_speed*block->feed_override/100.0;
+  
+  #ifdef PLANNER_SLOWDOWN
+    // Time of the block at its feed rate. Runs of short blocks drain the buffer faster than new 
+    // blocks are parsed and planned. While the buffer runs low, the block is stretched towards
+    // PLANNER_MIN_SEGMENT_TIME, the more the less blocks are left. The first blocks after a stop 
+    // are not slowed down.
+    float segment_time = millimeters/speed_limit * 60000000.0;        // (usec)
+    pl.segment_time += 0.25*(segment_time - pl.segment_time);
+    uint8_t blocks_queued = plan_blocks_queued();
+    if ((blocks_queued > 1) && (blocks_queued < BLOCK_BUFFER_SIZE/2) && 
+        (pl.segment_time < PLANNER_MIN_SEGMENT_TIME) && (segment_time < PLANNER_MIN_SEGMENT_TIME)) {
+      segment_time += 2.0*(PLANNER_MIN_SEGMENT_TIME - segment_time)/blocks_queued;
+      speed_limit = millimeters/segment_time * 60000000.0;
+      plan_stats.slowdowns++;
+    }
+  #endif
+  inverse_minute = speed_limit * inverse_millimeters;
+  
   block->nominal_rate = ceil(block->step_event_count * inverse_minute); // (step/min) Always > 0
+  float nominal_speed = millimeters*block->nominal_rate/block->step_event_count; // (mm/min) Always > 0
 
   // Compute the acceleration rate for the trapezoid generator. Depending on the slope of the line
   // average travel per step event changes. For a line along one axis the travel per step event
@@ -410,17 +896,46 @@ void plan_buffer_line(float x, float y, float u, float z, float feed_rate, uint8
   // To generate trapezoids with constant acceleration between blocks the rate_delta must be computed
   // specifically for each line to compensate for this phenomenon:
   // Convert universal acceleration for direction-dependent stepper rate change parameter
-  block->rate_delta = ceil( block->step_event_count*inverse_millimeters *
-        settings.acceleration / (60 * ACCELERATION_TICKS_PER_SECOND )); // (step/min/acceleration_tick)
+  // The rate_delta is limited to 16 bit, the acceleration is reduced for extreme settings.
+  block->rate_delta = min( 0xFFFF, ceil( block->step_event_count*inverse_millimeters *
+        acceleration / (60 * ACCELERATION_TICKS_PER_SECOND ))); // (step/min/acceleration_tick)
+  acceleration = millimeters*block->rate_delta*(60*ACCELERATION_TICKS_PER_SECOND)/block->step_event_count;
+
+  #ifdef PLANNER_FIXED_POINT
+    block->nominal_speed = max(1, min(BLOCK_MAX_SPEED, nominal_speed));
+    block->delta_v2 = min(4294967295.0, 2*acceleration*millimeters);
+  #else
+    block->millimeters = millimeters;
+  #endif
 
-  // Compute path unit vector
-  float unit_vec[N_AXIS];
-  unit_vec[X_AXIS] = delta_mm[X_AXIS]*inverse_millimeters;
-  unit_vec[Y_AXIS] = delta_mm[Y_AXIS]*inverse_millimeters;
-  unit_vec[Z_AXIS] = delta_mm[Z_AXIS]*inverse_millimeters;
-  unit_vec[U_AXIS] = delta_mm[U_AXIS]*inverse_millimeters;
+  uint32_t junction_time = sys_micros();
 
-  // SKW TODO: handle U_AXIS and decouple XY / UV planes
+  // Compute path unit vector
+  unit_t unit_vec[N_AXIS];
+  float inverse_unit;
+  #ifdef FOAM_CUTTER
+    // Separate unit vectors for the XY and the UZ plane. A plane without travel has a zero vector.
+    float plane_ratio[2] = {0.0, 0.0};              // Travel of the plane relative to the block millimeters
+    memset(unit_vec, 0, sizeof(unit_vec));
+    if (plane_mm[0] > 0.0) {
+      inverse_unit = UNIT_ONE/plane_mm[0];
+      unit_vec[X_AXIS] = delta_mm[X_AXIS]*inverse_unit;
+      unit_vec[Y_AXIS] = delta_mm[Y_AXIS]*inverse_unit;
+      plane_ratio[0]   = plane_mm[0]*inverse_millimeters;
+    }
+    if (plane_mm[1] > 0.0) {
+      inverse_unit = UNIT_ONE/plane_mm[1];
+      unit_vec[Z_AXIS] = delta_mm[Z_AXIS]*inverse_unit;
+      unit_vec[U_AXIS] = delta_mm[U_AXIS]*inverse_unit;
+      plane_ratio[1]   = plane_mm[1]*inverse_millimeters;
+    }
+  #else
+    inverse_unit = UNIT_ONE*inverse_millimeters;
+    unit_vec[X_AXIS] = delta_mm[X_AXIS]*inverse_unit;
+    unit_vec[Y_AXIS] = delta_mm[Y_AXIS]*inverse_unit;
+    unit_vec[Z_AXIS] = delta_mm[Z_AXIS]*inverse_unit;
+    unit_vec[U_AXIS] = delta_mm[U_AXIS]*inverse_unit;
+  #endif
 
   // Compute maximum allowable entry speed at junction by centripetal acceleration approximation.
   // Let a circle be tangent to both previous and current path line segments, where the junction
@@ -432,41 +947,37 @@ void plan_buffer_line(float x, float y, float u, float z, float feed_rate, uint8
   // from path, but used as a robust way to compute cornering speeds, as it takes into account the
   // nonlinearities of both the junction angle and junction velocity.
   // NOTE: This is basically an exact path mode (G61), but it doesn't come to a complete stop unless
-  // the junction deviation value is high. In the future, if continuous mode (G64) is desired, the
-  // math here is exactly the same. Instead of motioning all the way to junction point, the machine
-  // will just need to follow the arc circle defined above and check if the arc radii are no longer
-  // than half of either line segment to ensure no overlapping. Right now, the Arduino likely doesn't
-  // have the horsepower to do these calculations at high feed rates.
+  // the junction deviation value is high. The continuous path mode (G64) rounds the corners in 
+  // mc_line() before the segments reach the planner, see PATH_BLENDING.
   float vmax_junction = MINIMUM_PLANNER_SPEED; // Set default max junction speed
+  float vmax_nominal = BLOCK_MAX_SPEED;
 
   // Skip first block or when previous_nominal_speed is used as a flag for homing and offset cycles.
+  // Only the limit by the path angle is kept in the block, the nominal speeds limit the entry speed
+  // in addition, see block_max_entry_speed().
   if ((block_buffer_head != block_buffer_tail) && (pl.previous_nominal_speed > 0.0)) {
-    // Compute cosine of angle between previous and current path. (prev_unit_vec is negative)
-    // NOTE: Max junction velocity is computed without sin() or acos() by trig half angle identity.
-    float cos_theta = - pl.previous_unit_vec[X_AXIS] * unit_vec[X_AXIS]
-                      - pl.previous_unit_vec[Y_AXIS] * unit_vec[Y_AXIS]
-                      - pl.previous_unit_vec[Z_AXIS] * unit_vec[Z_AXIS]
-                      // - pl.previous_unit_vec[U_AXIS] * unit_vec[U_AXIS]     //Have NO IDEA IF IT WORKS OR NOT!!!!!!!!!!!!!
-                      /// 8c1  no U_AXIS                                        // TODO
-                        ;
-
-    // Skip and use default max junction speed for 0 degree acute junction.
-    if (cos_theta < 0.95) {
-      vmax_junction = min(pl.previous_nominal_speed,block->nominal_speed);
-      // Skip and avoid divide by zero for straight junctions at 180 degrees. Limit to min() of nominal speeds.
-      if (cos_theta > -0.95) {
-        // Compute maximum junction velocity based on maximum acceleration and junction deviation
-        float sin_theta_d2 = sqrt(0.5*(1.0-cos_theta)); // Trig half angle identity. Always positive.
-        vmax_junction = min(vmax_junction,
-          sqrt(settings.acceleration * settings.junction_deviation * sin_theta_d2/(1.0-sin_theta_d2)) );
-      }
-    }
+    vmax_junction = BLOCK_MAX_SPEED;
+    vmax_nominal = min(pl.previous_nominal_speed,nominal_speed);
+    junction_t factor = junction_factor(acceleration);
+    #ifdef FOAM_CUTTER
+      // Both wire ends must pass the junction, each in its own plane. The tighter limit wins.
+      vmax_junction = plane_junction_speed(X_AXIS, Y_AXIS, unit_vec, plane_ratio[0], 0, factor, vmax_junction);
+      vmax_junction = plane_junction_speed(Z_AXIS, U_AXIS, unit_vec, plane_ratio[1], 1, factor, vmax_junction);
+    #else
+      // Compute cosine of angle between previous and current path. (prev_unit_vec is negative)
+      cosine_t cos_theta = - (cosine_t)pl.previous_unit_vec[X_AXIS] * unit_vec[X_AXIS]
+                           - (cosine_t)pl.previous_unit_vec[Y_AXIS] * unit_vec[Y_AXIS]
+                           - (cosine_t)pl.previous_unit_vec[Z_AXIS] * unit_vec[Z_AXIS]
+                           - (cosine_t)pl.previous_unit_vec[U_AXIS] * unit_vec[U_AXIS];
+      vmax_junction = junction_speed(cos_theta, factor, vmax_junction);
+    #endif
   }
-  block->max_entry_speed = vmax_junction;
+  junction_time = sys_micros() - junction_time;
+  block->max_junction_speed = min(vmax_junction, BLOCK_MAX_SPEED);
 
   // Initialize block entry speed. Compute based on deceleration to user-defined MINIMUM_PLANNER_SPEED.
-  float v_allowable = max_allowable_speed(-settings.acceleration,MINIMUM_PLANNER_SPEED,block->millimeters);
-  block->entry_speed = min(vmax_junction, v_allowable);
+  uint16_t v_allowable = block_allowable_speed(block,MINIMUM_PLANNER_SPEED);
+  block->entry_speed = min(min(block->max_junction_speed, vmax_nominal), v_allowable);
 
   // Initialize planner efficiency flags
   // Set flag if block will always reach maximum junction speed regardless of entry/exit speeds.
@@ -476,13 +987,28 @@ void plan_buffer_line(float x, float y, float u, float z, float feed_rate, uint8
   // block nominal speed limits both the current and next maximum junction speeds. Hence, in both
   // the reverse and forward planners, the corresponding block junction speed will always be at the
   // the maximum junction speed and may always be ignored for any speed reduction checks.
-  if (block->nominal_speed <= v_allowable) { block->nominal_length_flag = true; }
-  else { block->nominal_length_flag = false; }
-  block->recalculate_flag = true; // Always calculate trapezoid for new block
+  block->flags = BLOCK_FLAG_RECALCULATE; // Always calculate trapezoid for new block
+  if (nominal_speed <= v_allowable) { block->flags |= BLOCK_FLAG_NOMINAL_LENGTH; }
 
   // Update previous path unit_vector and nominal speed
   memcpy(pl.previous_unit_vec, unit_vec, sizeof(unit_vec)); // pl.previous_unit_vec[] = unit_vec[]
-  pl.previous_nominal_speed = block->nominal_speed;
+  pl.previous_nominal_speed = nominal_speed;
+  #ifdef FOAM_CUTTER
+    memcpy(pl.previous_plane_ratio, plane_ratio, sizeof(plane_ratio));
+  #endif
+
+  #ifdef LASER_RASTER
+    // Keep the pixels in the raster buffer until the stepper has executed the block
+    if (block->raster_count) {
+      uint16_t start = block->raster - raster.buffer;
+      uint8_t sreg = SREG;
+      cli();
+      if (raster.blocks == 0) { raster.tail = start; }
+      raster.blocks++;
+      SREG = sreg;
+      raster.head = start + block->raster_count;
+    }
+  #endif
 
   // Update buffer head and next buffer head indices
   block_buffer_head = next_buffer_head;
@@ -491,9 +1017,140 @@ void plan_buffer_line(float x, float y, float u, float z, float feed_rate, uint8
   // Update planner position
   memcpy(pl.position, target, sizeof(target)); // pl.position[] = target[]
 
+  uint32_t plan_time = sys_micros();
   planner_recalculate();
+  plan_time = sys_micros() - plan_time;
+  
+  // Update the performance counters
+  plan_stats.blocks_planned++;
+  plan_stats.plan_time += plan_time;
+  plan_stats.junction_time += junction_time;
+  if (plan_time > plan_stats.plan_time_max) { plan_stats.plan_time_max = plan_time; }
+}
+
+// Returns the feed override in % the block follows, at most the override its axes reach their max
+// rates with. An axis runs steps/step_event_count of the nominal rate, the rate at 100% is the nominal
+// rate divided by the override the block is planned with. The limit is at most 255%.
+static uint8_t block_override_scale(block_t *block, uint8_t percent)
+{
+  uint16_t steps[N_AXIS];
+  steps[X_AXIS] = block->steps_x;
+  steps[Y_AXIS] = block->steps_y;
+  steps[Z_AXIS] = block->steps_z;
+  steps[U_AXIS] = block->steps_u;
+  float rate_limit = 255.0*block->nominal_rate/block->feed_override;     // (step/min) at 255%
+  uint8_t idx;
+  for (idx=0; idx<N_AXIS; idx++) {
+    if (steps[idx]) {
+      rate_limit = min(rate_limit, (settings.max_rate[idx]*settings.steps_per_mm[idx]*block->step_event_count)/steps[idx]);
+    }
+  }
+  uint8_t override_limit = max(1, floor(rate_limit*block->feed_override/block->nominal_rate));
+  return( min(percent, override_limit) );
+}
+
+
+// Returns the nominal rate of a block for a new feed override scale, rescaled from the override it
+// is planned with.
+static uint32_t block_override_rate(block_t *block, uint8_t scale)
+{
+  return( max(1, (block->nominal_rate*scale + block->feed_override-1)/block->feed_override) );
+}
+
+
+// Returns the nominal speed of a block in mm/min for a new nominal rate
+static float block_override_speed(block_t *block, uint32_t nominal_rate)
+{
+  #ifdef PLANNER_FIXED_POINT
+    return( max(1, min(BLOCK_MAX_SPEED, ((float)block->nominal_speed*nominal_rate)/block->nominal_rate)) );
+  #else
+    return( (block->millimeters*nominal_rate)/block->step_event_count );
+  #endif
 }
 
+
+// Changes the feed override. The nominal rates of all blocks in the buffer are rescaled and their
+// entry speeds are limited again by the junction and the new nominal speeds. The block in execution
+// keeps its entry and exit speed and the stepper ramps to its new nominal rate, if the rest of the
+// block is long enough, see st_set_nominal_rate(). The entry speed of the following block is fixed
+// by the exit of the block in execution. It is not slowed down below its entry speed, the override 
+// reaches it with the next block then. A block not rescaled keeps the override it is planned with.
+// The buffer is replanned from the block following the block in execution.
+void plan_set_feed_override(int16_t percent)
+{
+  percent = max(FEED_OVERRIDE_MIN, min(FEED_OVERRIDE_MAX, percent));
+  if (percent == sys.feed_override) { return; }
+  sys.feed_override = percent;
+
+  uint8_t block_index = block_buffer_tail;
+  if (block_index == block_buffer_head) { return; }  // Buffer empty
+
+  // Block in execution
+  block_t *block = &block_buffer[block_index];
+  uint8_t entry_fixed = false;
+  uint32_t old_rate = block->nominal_rate;
+  uint32_t nominal_rate = old_rate;
+  uint8_t scale = block->feed_override;
+  if (!(block->flags & BLOCK_FLAG_DWELL)) {
+    scale = block_override_scale(block, percent);
+    nominal_rate = block_override_rate(block, scale);
+  }
+  #ifdef PLANNER_FIXED_POINT
+    uint16_t nominal_speed = block_override_speed(block, nominal_rate);
+  #endif
+  if (st_set_nominal_rate(nominal_rate)) {
+    if ((block->nominal_rate != old_rate) || (nominal_rate == old_rate)) {
+      block->feed_override = scale;
+      #ifdef PLANNER_FIXED_POINT
+        block->nominal_speed = nominal_speed;
+      #endif
+    }
+    block_index = next_block_index(block_index);
+    entry_fixed = true;
+  }
+  uint8_t first_index = block_index;
+
+  // The first block keeps the junction to the block before, its entry speed is only limited by its own
+  // new nominal speed.
+  block_t *previous = NULL;
+  while (block_index != block_buffer_head) {
+    block = &block_buffer[block_index];
+    if (!(block->flags & BLOCK_FLAG_DWELL)) {
+      scale = block_override_scale(block, percent);
+      nominal_rate = block_override_rate(block, scale);
+      float nominal_speed = block_override_speed(block, nominal_rate);
+      if ((block_index != first_index) || (nominal_speed >= block->entry_speed) || !entry_fixed) {
+        block->nominal_rate = nominal_rate;
+        block->feed_override = scale;
+        #ifdef PLANNER_FIXED_POINT
+          block->nominal_speed = nominal_speed;
+        #endif
+      }
+      nominal_speed = block_override_speed(block, block->nominal_rate);
+      // Start from the entry speed of a new block, the reverse pass raises it again where possible.
+      // The first block keeps its entry, the junction to the block before is passed already.
+      uint16_t v_allowable = block_allowable_speed(block,MINIMUM_PLANNER_SPEED);
+      uint16_t max_entry_speed = block_max_entry_speed(previous, block);
+      if (block_index == first_index) {
+        block->entry_speed = min(block->entry_speed, max_entry_speed);
+      } else {
+        block->entry_speed = min(v_allowable, max_entry_speed);
+      }
+      block->flags &= ~BLOCK_FLAG_NOMINAL_LENGTH;
+      if (nominal_speed <= v_allowable) { block->flags |= BLOCK_FLAG_NOMINAL_LENGTH; }
+    }
+    block->flags |= BLOCK_FLAG_RECALCULATE;
+    previous = block;
+    block_index = next_block_index(block_index);
+  }
+  if (first_index == block_buffer_head) { return; }
+  
+  // Replan the buffer behind the block in execution. Its entry speed is kept.
+  block_buffer_planned = first_index;
+  planner_recalculate();
+}
+
+
 // Reset the planner position vector (in steps). Called by the system abort routine.
 /// 8c1
 void plan_set_current_position(int32_t x, int32_t y, int32_t u, int32_t z)
@@ -504,22 +1161,41 @@ void plan_set_current_position(int32_t x, int32_t y, int32_t u, int32_t z)
   pl.position[U_AXIS] = u;
 }
 
+// Returns the planner position, the end of the last block, in millimeters
+void plan_get_position(float *position)
+{
+  uint8_t idx;
+  for (idx=0; idx<N_AXIS; idx++) {
+    position[idx] = pl.position[idx]/settings.steps_per_mm[idx];
+  }
+}
+
 // Re-initialize buffer plan with a partially completed block, assumed to exist at the buffer tail.
 // Called after a steppers have come to a complete stop for a feed hold and the cycle is stopped.
 void plan_cycle_reinitialize(int32_t step_events_remaining)
 {
   block_t *block = &block_buffer[block_buffer_tail]; // Point to partially completed block
 
-  // Only remaining millimeters and step_event_count need to be updated for planner recalculate.
+  // A dwell block only resumes the remaining time
+  if (block->flags & BLOCK_FLAG_DWELL) {
+    block->step_event_count = step_events_remaining;
+    return;
+  }
+
+  // Only remaining millimeters (delta_v2) and step_event_count need to be updated for planner recalculate.
   // Other variables (step_x, step_y, step_z, rate_delta, etc.) all need to remain the same to
   // ensure the original planned motion is resumed exactly.
-  block->millimeters = (block->millimeters*step_events_remaining)/block->step_event_count;
+  #ifdef PLANNER_FIXED_POINT
+    block->delta_v2 = ((float)block->delta_v2*step_events_remaining)/block->step_event_count;
+  #else
+    block->millimeters = (block->millimeters*step_events_remaining)/block->step_event_count;
+  #endif
   block->step_event_count = step_events_remaining;
 
   // Re-plan from a complete stop. Reset planner entry speeds and flags.
-  block->entry_speed = 0.0;
-  block->max_entry_speed = 0.0;
-  block->nominal_length_flag = false;
-  block->recalculate_flag = true;
+  block->entry_speed = 0;
+  block->max_junction_speed = 0;
+  block->flags = BLOCK_FLAG_RECALCULATE;
+  block_buffer_planned = block_buffer_tail;  // Replan the whole buffer from the stopped block
   planner_recalculate();
 }
@@ -12,36 +12,79 @@
 #define C_ARC 1
 #define C_LINE 0
 
+// Max. number of step events of a block. Longer lines are split into several blocks by motion_control.
+#define BLOCK_MAX_STEP_EVENTS 65000
+// Max. speed a block entry speed can hold in mm/min
+#define BLOCK_MAX_SPEED 0xFFFF
+
+// Planner flags of a block
+#define BLOCK_FLAG_RECALCULATE    bit(0)  // Recalculate trapezoid on entry junction
+#define BLOCK_FLAG_NOMINAL_LENGTH bit(1)  // Nominal speed always reached
+#define BLOCK_FLAG_DWELL          bit(2)  // Dwell without motion, one step event per msec
+
+// Step event rate of a dwell block in events/min
+#define BLOCK_DWELL_RATE 60000
+
 // This struct is used when buffering the setup for each linear movement "nominal" values are as specified in
 // the source g-code and may never actually be reached if acceleration management is active.
+// The block is kept small (41 bytes, +2 with PLANNER_FIXED_POINT, +4 with S_CURVE_ACCELERATION, +3 with LASER_RASTER) to fit
+// as many blocks as possible into the RAM. The maximum entry speed is derived from the junction speed
+// and the nominal speeds, the override limit from the axis max rates. Without PLANNER_FIXED_POINT the
+// nominal speed and the acceleration are derived from the nominal_rate and the rate_delta, too.
 typedef struct {
 
   // Fields used by the bresenham algorithm for tracing the line
   uint8_t  direction_bits;            // The direction bit set for this block (refers to *_DIRECTION_BIT in config.h)
 /// 8c1
-  uint32_t steps_x, steps_y, steps_z, steps_u; // Step count along each axis
-/// 8c0 int32_t -> uint32_t
-  uint32_t  step_event_count;          // The number of step events required to complete this block
+  uint16_t steps_x, steps_y, steps_z, steps_u; // Step count along each axis
+/// 8c0 int32_t -> uint32_t -> uint16_t
+  uint16_t step_event_count;          // The number of step events required to complete this block (max. BLOCK_MAX_STEP_EVENTS)
 
   // Fields used by the motion planner to manage acceleration
-  float nominal_speed;               // The nominal speed for this block in mm/min
-  float entry_speed;                 // Entry speed at previous-current block junction in mm/min
-  float max_entry_speed;             // Maximum allowable junction entry speed in mm/min
-  float millimeters;                 // The total travel of this block in mm
-  uint8_t recalculate_flag;           // Planner flag to recalculate trapezoids on entry junction
-  uint8_t nominal_length_flag;        // Planner flag for nominal speed always reached
+  uint16_t entry_speed;               // Entry speed at previous-current block junction in mm/min
+  uint16_t max_junction_speed;        // Junction speed limit by the path angle in mm/min, without the 
+                                      // nominal speeds of the blocks at the junction
+  uint8_t feed_override;              // Feed override in % the nominal rate is planned with, at most
+                                      // the override the axis max rates allow
+#ifdef PLANNER_FIXED_POINT
+  uint16_t nominal_speed;             // The nominal speed for this block in mm/min
+  uint32_t delta_v2;                  // Square speed change at full acceleration over the block, 
+                                      // 2*acceleration*millimeters in (mm/min)^2
+#else
+  float millimeters;                  // The total travel of this block in mm
+#endif
+  uint8_t flags;                      // Planner flags BLOCK_FLAG_*
 
   // Settings for the trapezoid generator
   uint32_t initial_rate;              // The step rate at start of block
   uint32_t final_rate;                // The step rate at end of block
-  int32_t rate_delta;                 // The steps/minute to add or subtract when changing speed (must be positive)
-  uint32_t accelerate_until;          // The index of the step event on which to stop acceleration
-  uint32_t decelerate_after;          // The index of the step event on which to start decelerating
   uint32_t nominal_rate;              // The nominal step rate for this block in step_events/minute
+  uint16_t rate_delta;                // The steps/minute to add or subtract when changing speed
+  uint16_t accelerate_until;          // The index of the step event on which to stop acceleration
+  uint16_t decelerate_after;          // The index of the step event on which to start decelerating
+#ifdef S_CURVE_ACCELERATION
+  uint16_t accelerate_ticks;          // The number of acceleration ticks of the acceleration ramp
+  uint16_t decelerate_ticks;          // The number of acceleration ticks of the deceleration ramp
+#endif
   int8_t tool_state;                  // Tool state 
-  float tool_pwr;                     // Tool Power
+  uint8_t tool_pwr;                   // Tool Power 0...TOOL_PWR_MAX
+#ifdef LASER_RASTER
+  uint8_t *raster;                    // Power of the pixels along the line 0...TOOL_PWR_MAX, in the raster buffer
+  uint8_t raster_count;               // Number of pixels, 0 = constant power tool_pwr
+#endif
 } block_t;
 
+// Planner performance counters, cleared by plan_init() and reported with $P
+typedef struct {
+  uint32_t blocks_planned;            // Number of blocks added to the plan
+  uint32_t blocks_replanned;          // Sum of the blocks revisited by the reverse pass for all new blocks
+  uint32_t plan_time;                 // Total time spent in planner_recalculate() in usec
+  uint32_t plan_time_max;             // Longest planning time of a single block in usec
+  uint32_t junction_time;             // Total time spent on the unit vectors and junction speeds in usec
+  uint32_t slowdowns;                 // Number of blocks slowed down because the buffer ran low
+} plan_statistics_t;
+extern plan_statistics_t plan_stats;
+
 // Initialize the motion plan subsystem
 void plan_init();
 
@@ -51,10 +94,28 @@ void plan_init();
 /// 8c1
 void plan_buffer_line(float x, float y, float u, float z, float feed_rate, uint8_t invert_feed_rate, uint8_t t_arc, int8_t tool_state, float tool_pwr);
 
+// Add a dwell to the buffer, a block without motion which the stepper executes in order with the 
+// motions. The motion before comes to a stop. The tool state and power are set at the start of the
+// dwell, so tool changes are queued as short dwells. Time in msec, 1...BLOCK_MAX_STEP_EVENTS.
+void plan_buffer_dwell(uint16_t milliseconds, int8_t tool_state, float tool_pwr);
+
+#ifdef LASER_RASTER
+// Stores the power of the pixels of a raster line (0...TOOL_PWR_MAX) in the raster buffer. The next 
+// block added by plan_buffer_line() runs them, spread evenly over its step events. Returns false, if
+// the buffer has no room, until the stepper has executed the blocks before.
+uint8_t plan_buffer_raster(uint8_t *pwr, uint8_t count);
+#endif
+
 // Called when the current block is no longer needed. Discards the block and makes the memory
 // availible for new blocks.
 void plan_discard_current_block();
 
+#ifdef LASER_RASTER
+// Frees the pixels of a raster block after its execution. Called by the stepper with the last step
+// event of the block, the pixels are still traced after the block is discarded.
+void plan_discard_raster(uint8_t *raster, uint8_t count);
+#endif
+
 // Gets the current block. Returns NULL if buffer empty
 block_t *plan_get_current_block();
 
@@ -62,6 +123,9 @@ block_t *plan_get_current_block();
 /// 8c1
 void plan_set_current_position(int32_t x, int32_t y, int32_t u, int32_t z);
 
+// Returns the planner position, the end of the last block, in millimeters
+void plan_get_position(float *position);
+
 // Reinitialize plan with a partially completed block
 void plan_cycle_reinitialize(int32_t step_events_remaining);
 
@@ -71,6 +135,16 @@ void plan_reset_buffer();
 // Returns the status of the block ring buffer. True, if buffer is full.
 uint8_t plan_check_full_buffer();
 
+// Returns the number of blocks in the ring buffer
+uint8_t plan_blocks_queued();
+
+// Returns the execution time of a planned block in seconds, taken from its trapezoid
+float plan_block_time(block_t *block);
+
+// Sets the feed override in % (FEED_OVERRIDE_MIN...FEED_OVERRIDE_MAX) and rescales the nominal 
+// rates of the blocks in the buffer, including the block in execution.
+void plan_set_feed_override(int16_t percent);
+
 // Block until all buffered steps are executed
 void plan_synchronize();
 
@@ -19,6 +19,8 @@
 #include "report.h"
 #include "lcd.h"
 #include "motion_control.h"
+#include "planner.h"
+#include "tool.h"
 
 #if (U_AXIS != 3)
   #error
@@ -78,6 +80,9 @@ void protocol_execute_startup()
 // limit switches, or the main program.
 void protocol_execute_runtime()
 {
+  st_idle_lock(); // Disable the steppers after the idle lock time
+  lcd_poll_encoder(); // No step of the rotary encoder is lost while the main program waits
+
   if (sys.execute) { // Enter only if any bit flag is true
     uint8_t rt_exec = sys.execute; // Avoid calling volatile multiple times
 
@@ -99,8 +104,7 @@ void protocol_execute_runtime()
           // Nothing. Block EVERYTHING until user issues reset or power cycles. Hard limits
           // typically occur while unattended or not paying attention. Gives the user time
           // to do what is needed before resetting, like killing the incoming stream.
-
-          
+          st_idle_lock();
         } while (bit_isfalse(sys.execute,EXEC_RESET));
 
       // Standard alarm event. Only abort during motion qualifies.
@@ -148,8 +152,32 @@ void protocol_execute_runtime()
     }
   }
 
-  // Overrides flag byte (sys.override) and execution should be installed here, since they
-  // are runtime and require a direct and controlled interface to the main stepper program.
+  // Overrides flag byte (sys.override). The feed override rescales the planned blocks, the tool
+  // power override the pwm of the running block.
+  if (sys.override) {
+    uint8_t sreg = SREG;
+    cli();
+    uint8_t rt_ovr = sys.override;
+    sys.override = 0;
+    SREG = sreg;
+
+    int16_t feed = sys.feed_override;
+    if (rt_ovr & OVR_FEED_RESET) { feed = 100; }
+    if (rt_ovr & OVR_FEED_COARSE_PLUS) { feed += OVERRIDE_COARSE_INCREMENT; }
+    if (rt_ovr & OVR_FEED_COARSE_MINUS) { feed -= OVERRIDE_COARSE_INCREMENT; }
+    if (rt_ovr & OVR_FEED_FINE_PLUS) { feed += OVERRIDE_FINE_INCREMENT; }
+    if (rt_ovr & OVR_FEED_FINE_MINUS) { feed -= OVERRIDE_FINE_INCREMENT; }
+    plan_set_feed_override(feed);
+
+    int16_t tool = sys.tool_override;
+    if (rt_ovr & OVR_TOOL_RESET) { tool = 100; }
+    if (rt_ovr & OVR_TOOL_COARSE_PLUS) { tool += OVERRIDE_COARSE_INCREMENT; }
+    if (rt_ovr & OVR_TOOL_COARSE_MINUS) { tool -= OVERRIDE_COARSE_INCREMENT; }
+    if (tool != sys.tool_override) { tool_set_override(tool); }
+  }
+
+  // Fill the segment buffer of the stepper interrupt
+  st_prep_buffer();
 }
 
 
@@ -195,6 +223,12 @@ uint8_t protocol_execute_line(char *line)
         else
           report_gcode_modes();
         break;
+      case 'P' : // Prints performance counters
+        if ( line[++char_counter] != 0 )
+          return(STATUS_UNSUPPORTED_STATEMENT);
+        else
+          report_performance_counters();
+        break;
       case 'C' : // Set check g-code mode
         if ( line[++char_counter] != 0 ) { return(STATUS_UNSUPPORTED_STATEMENT); }
         // Perform reset when toggling off. Check g-code mode should only work if Grbl
@@ -211,6 +245,21 @@ uint8_t protocol_execute_line(char *line)
           report_feedback_message(MESSAGE_ENABLED);
         }
         break;
+      case 'E' : // Toggle the job time estimate
+        if ( line[++char_counter] != 0 ) { return(STATUS_UNSUPPORTED_STATEMENT); }
+        // The g-code sent in between is planned without motion. Toggling off reports the estimate
+        // and restores the parser state from before.
+        if ( sys.state == STATE_DRY_RUN ) {
+          mc_estimate_t estimate;
+          mc_dry_run_end(&estimate);
+          report_estimate(estimate.cut_time, estimate.travel_time, estimate.dwell_time, estimate.stall_time, estimate.blocks);
+        }
+        else {
+          if (!mc_dry_run_begin())
+            return(STATUS_IDLE_ERROR);
+          report_feedback_message(MESSAGE_ENABLED);
+        }
+        break;
       case 'X' : // Disable alarm lock
         if ( line[++char_counter] != 0 )
           return(STATUS_UNSUPPORTED_STATEMENT);
@@ -364,6 +413,7 @@ void protocol_process()
 // during a synchronize call, if it should happen. Also, waits for clean cycle end.
 void protocol_buffer_synchronize()
 {
+  mc_line_flush();              // Send a segment held back for merging
   // If system is queued, ensure cycle resumes if the auto start flag is present.
   do {
     protocol_execute_runtime();   // Check and execute run-time commands
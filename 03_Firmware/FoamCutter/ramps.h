@@ -23,6 +23,7 @@ extern "C" {
     extern void rampsWriteDisable(uint8_t value);
     extern void rampsWriteSteps(uint8_t value);
     extern void rampsWriteDirections(uint8_t value);
+    extern void rampsWritePort(volatile uint8_t *port, uint8_t mask, uint8_t bits);
 
 /**
      * Perform port direction init for ramps for steppers
@@ -61,32 +62,74 @@ extern "C" {
         }
     }
 
+/**
+     * Step and direction outputs. The pins of the axes are grouped by their port: every port of the
+     * pin map gets one masked write per call, with the pins of all axes on that port. The port
+     * registers are constant addresses, so the compiler resolves the port comparisons and masks of
+     * the RAMPS_* macros at compile time and no bit of value is tested at run time except for the
+     * output bits. On the RAMPS board each axis has its own port (A, C, L and F), other pin maps
+     * with several axes on one port get their step edges at the same time.
+     */
+#define RAMPS_PORT(IO)      _RAMPS_PORT(IO)
+#define _RAMPS_PORT(IO)     DIO ## IO ## _WPORT
+#define RAMPS_PIN_MASK(IO)  _RAMPS_PIN_MASK(IO)
+#define _RAMPS_PIN_MASK(IO) MASK(DIO ## IO ## _PIN)
+
+// True, if the pins IO1 and IO2 are on the same port
+#define RAMPS_SAME_PORT(IO1, IO2)  (&RAMPS_PORT(IO1) == &RAMPS_PORT(IO2))
+// Mask of the pin IO, if it is on the port of PORT_IO
+#define RAMPS_PORT_MASK(PORT_IO, IO)  (RAMPS_SAME_PORT(PORT_IO, IO) ? RAMPS_PIN_MASK(IO) : 0)
+// Output of the pin IO on the port of PORT_IO for the bit BIT of value, inverted if INV is 1
+#define RAMPS_PORT_BITS(PORT_IO, IO, value, BIT, INV)  ((!CHECK(value, BIT) == INV) ? RAMPS_PORT_MASK(PORT_IO, IO) : 0)
+
+#define RAMPS_STEP_MASK(PORT_IO)  (RAMPS_PORT_MASK(PORT_IO, X_STEP_PIN) | RAMPS_PORT_MASK(PORT_IO, Y_STEP_PIN) | \
+                                   RAMPS_PORT_MASK(PORT_IO, Z_STEP_PIN) | RAMPS_PORT_MASK(PORT_IO, U_STEP_PIN))
+#define RAMPS_STEP_BITS(PORT_IO, value)  (RAMPS_PORT_BITS(PORT_IO, X_STEP_PIN, value, X_STEP_BIT, 0) | \
+                                          RAMPS_PORT_BITS(PORT_IO, Y_STEP_PIN, value, Y_STEP_BIT, 0) | \
+                                          RAMPS_PORT_BITS(PORT_IO, Z_STEP_PIN, value, Z_STEP_BIT, 0) | \
+                                          RAMPS_PORT_BITS(PORT_IO, U_STEP_PIN, value, U_STEP_BIT, 0))
+
+// The direction pins of Z and U are inverted
+#define RAMPS_DIR_MASK(PORT_IO)  (RAMPS_PORT_MASK(PORT_IO, X_DIR_PIN) | RAMPS_PORT_MASK(PORT_IO, Y_DIR_PIN) | \
+                                  RAMPS_PORT_MASK(PORT_IO, Z_DIR_PIN) | RAMPS_PORT_MASK(PORT_IO, U_DIR_PIN))
+#define RAMPS_DIR_BITS(PORT_IO, value)  (RAMPS_PORT_BITS(PORT_IO, X_DIR_PIN, value, X_DIRECTION_BIT, 0) | \
+                                         RAMPS_PORT_BITS(PORT_IO, Y_DIR_PIN, value, Y_DIRECTION_BIT, 0) | \
+                                         RAMPS_PORT_BITS(PORT_IO, Z_DIR_PIN, value, Z_DIRECTION_BIT, 1) | \
+                                         RAMPS_PORT_BITS(PORT_IO, U_DIR_PIN, value, U_DIRECTION_BIT, 1))
+
+/**
+     * masked write of a port
+     * @param port
+     * @param mask pins written
+     * @param bits output of the pins
+     */
+    inline void rampsWritePort(volatile uint8_t *port, uint8_t mask, uint8_t bits) {
+        if (port >= (volatile uint8_t *)0x100) {
+            // Not in the I/O space, no atomic write. See _WRITE_C
+            CRITICAL_SECTION_START;
+            *port = (*port & ~mask) | bits;
+            CRITICAL_SECTION_END;
+        } else {
+            *port = (*port & ~mask) | bits;
+        }
+    }
+
 /**
      * write stepper pulse
      * @param value
      */
     inline void rampsWriteSteps(uint8_t value) {
-        if (CHECK(value, X_STEP_BIT)) {
-            WRITE(X_STEP_PIN, 1);
-        } else {
-            WRITE(X_STEP_PIN, 0);
+        rampsWritePort(&RAMPS_PORT(X_STEP_PIN), RAMPS_STEP_MASK(X_STEP_PIN), RAMPS_STEP_BITS(X_STEP_PIN, value));
+        if (!RAMPS_SAME_PORT(Y_STEP_PIN, X_STEP_PIN)) {
+            rampsWritePort(&RAMPS_PORT(Y_STEP_PIN), RAMPS_STEP_MASK(Y_STEP_PIN), RAMPS_STEP_BITS(Y_STEP_PIN, value));
         }
-        if (CHECK(value, Y_STEP_BIT)) {
-            WRITE(Y_STEP_PIN, 1);
-        } else {
-            WRITE(Y_STEP_PIN, 0);
+        if (!RAMPS_SAME_PORT(Z_STEP_PIN, X_STEP_PIN) && !RAMPS_SAME_PORT(Z_STEP_PIN, Y_STEP_PIN)) {
+            rampsWritePort(&RAMPS_PORT(Z_STEP_PIN), RAMPS_STEP_MASK(Z_STEP_PIN), RAMPS_STEP_BITS(Z_STEP_PIN, value));
         }
-        if (CHECK(value, Z_STEP_BIT)) {
-            WRITE(Z_STEP_PIN, 1);
-        } else {
-            WRITE(Z_STEP_PIN, 0);
+        if (!RAMPS_SAME_PORT(U_STEP_PIN, X_STEP_PIN) && !RAMPS_SAME_PORT(U_STEP_PIN, Y_STEP_PIN) &&
+            !RAMPS_SAME_PORT(U_STEP_PIN, Z_STEP_PIN)) {
+            rampsWritePort(&RAMPS_PORT(U_STEP_PIN), RAMPS_STEP_MASK(U_STEP_PIN), RAMPS_STEP_BITS(U_STEP_PIN, value));
         }
-        if (CHECK(value, U_STEP_BIT)) {
-            WRITE(U_STEP_PIN, 1);
-        } else {
-            WRITE(U_STEP_PIN, 0);
-         }
-
     }
 
 /**
@@ -94,25 +137,16 @@ extern "C" {
      * @param value
      */
     inline void rampsWriteDirections(uint8_t value) {
-        if (CHECK(value, X_DIRECTION_BIT)) {
-            WRITE(X_DIR_PIN, 1);
-        } else {
-            WRITE(X_DIR_PIN, 0);
+        rampsWritePort(&RAMPS_PORT(X_DIR_PIN), RAMPS_DIR_MASK(X_DIR_PIN), RAMPS_DIR_BITS(X_DIR_PIN, value));
+        if (!RAMPS_SAME_PORT(Y_DIR_PIN, X_DIR_PIN)) {
+            rampsWritePort(&RAMPS_PORT(Y_DIR_PIN), RAMPS_DIR_MASK(Y_DIR_PIN), RAMPS_DIR_BITS(Y_DIR_PIN, value));
         }
-        if (CHECK(value, Y_DIRECTION_BIT)) {
-            WRITE(Y_DIR_PIN, 1);
-        } else {
-            WRITE(Y_DIR_PIN, 0);
+        if (!RAMPS_SAME_PORT(Z_DIR_PIN, X_DIR_PIN) && !RAMPS_SAME_PORT(Z_DIR_PIN, Y_DIR_PIN)) {
+            rampsWritePort(&RAMPS_PORT(Z_DIR_PIN), RAMPS_DIR_MASK(Z_DIR_PIN), RAMPS_DIR_BITS(Z_DIR_PIN, value));
         }
-        if (CHECK(value, Z_DIRECTION_BIT)) {
-            WRITE(Z_DIR_PIN, 0);
-        } else {
-            WRITE(Z_DIR_PIN, 1);
-        }
-        if (CHECK(value, U_DIRECTION_BIT)) {
-            WRITE(U_DIR_PIN, 0);
-        } else {
-            WRITE(U_DIR_PIN, 1);
+        if (!RAMPS_SAME_PORT(U_DIR_PIN, X_DIR_PIN) && !RAMPS_SAME_PORT(U_DIR_PIN, Y_DIR_PIN) &&
+            !RAMPS_SAME_PORT(U_DIR_PIN, Z_DIR_PIN)) {
+            rampsWritePort(&RAMPS_PORT(U_DIR_PIN), RAMPS_DIR_MASK(U_DIR_PIN), RAMPS_DIR_BITS(U_DIR_PIN, value));
         }
     }
 
@@ -7,12 +7,16 @@
 */
 
 #include <avr/pgmspace.h>
+#include <avr/interrupt.h>
 #include "report.h"
 #include "print.h"
 #include "settings.h"
 #include "nuts_bolts.h"
 #include "gcode.h"
 #include "defaults.h"
+#include "planner.h"
+#include "motion_control.h"
+#include "stepper.h"
 
 
 #ifdef FOAM_CUTTER
@@ -179,10 +183,12 @@ void report_grbl_help() {
                           "$# (view # parameters)\r\n"
                           "$G (view parser state)\r\n"
                           "$N (view startup blocks)\r\n"
+                          "$P (view performance counters)\r\n"
                           "$x=value (save Grbl setting)\r\n"
                           "$Nx=line (save startup block)\r\n"
                           "$R (reset parameters to default)\r\n"
                           "$C (check gcode mode)\r\n"
+                          "$E (estimate job time)\r\n"
                           "$X (kill alarm lock)\r\n"
                           "$H (run homing cycle)\r\n"
                           "$~ (cycle start)\r\n"
@@ -208,9 +214,9 @@ void report_grbl_settings() {
     print_uint8_base2 (settings.invert_mask); printPgmString (PSTR (")\r\n$8=") );
     printInteger (settings.stepper_idle_lock_time);  printPgmString (PSTR (" (step idle delay, msec)\r\n$9=" ));
      // Convert from mm/min^2 for human readability
-    printFloat (settings.acceleration / (60 * 60) ); printPgmString (PSTR (" (acceleration, mm/sec^2)\r\n$10=") );
+    printFloat (settings.acceleration / (60 * 60) ); printPgmString (PSTR (" (path acceleration, mm/sec^2)\r\n$10=") );
     printFloat (settings.junction_deviation); printPgmString (PSTR (" (junction deviation, mm)\r\n$11=") );
-    printFloat (settings.mm_per_arc_segment); printPgmString (PSTR (" (arc, mm/segment)\r\n$12=") );
+    printFloat (settings.mm_per_arc_segment); printPgmString (PSTR (" (arc, min mm/segment)\r\n$12=") );
     printInteger (settings.n_arc_correction); printPgmString (PSTR (" (n-arc correction, int)\r\n$13=") );
     printInteger (settings.decimal_places); printPgmString (PSTR (" (n-decimals, int)\r\n$14=") );
     printInteger (bit_istrue (settings.flags, BITFLAG_REPORT_INCHES) ); printPgmString (PSTR (" (report inches, bool)\r\n$15=") );
@@ -230,7 +236,17 @@ void report_grbl_settings() {
     printInteger (settings.tool_pwr);printPgmString (PSTR (" (hotwire power, 0...100)\r\n$28=") );
     printInteger (settings.fan_pwr);printPgmString (PSTR (" (fan power, 0...100)\r\n$29=") );
     printFloat (settings.cutting_hor);printPgmString (PSTR (" (cutting distance horizontal, mm)\r\n$30=") );
-    printFloat (settings.cutting_ver);printPgmString (PSTR (" (cutting distance vertical, mm)\r\n") );
+    printFloat (settings.cutting_ver);printPgmString (PSTR (" (cutting distance vertical, mm)\r\n$31=") );
+    printFloat (settings.max_rate[X_AXIS]); printPgmString (PSTR (" (x, max rate, mm/min)\r\n$32=") );
+    printFloat (settings.max_rate[Y_AXIS]); printPgmString (PSTR (" (y, max rate, mm/min)\r\n$33=") );
+    printFloat (settings.max_rate[U_AXIS]); printPgmString (PSTR (" (u, max rate, mm/min)\r\n$34=") );
+    printFloat (settings.max_rate[Z_AXIS]); printPgmString (PSTR (" (z, max rate, mm/min)\r\n$35=") );
+    printFloat (settings.axis_acceleration[X_AXIS] / (60 * 60) ); printPgmString (PSTR (" (x, acceleration, mm/sec^2)\r\n$36=") );
+    printFloat (settings.axis_acceleration[Y_AXIS] / (60 * 60) ); printPgmString (PSTR (" (y, acceleration, mm/sec^2)\r\n$37=") );
+    printFloat (settings.axis_acceleration[U_AXIS] / (60 * 60) ); printPgmString (PSTR (" (u, acceleration, mm/sec^2)\r\n$38=") );
+    printFloat (settings.axis_acceleration[Z_AXIS] / (60 * 60) ); printPgmString (PSTR (" (z, acceleration, mm/sec^2)\r\n$39=") );
+    printFloat (settings.line_merge_tolerance); printPgmString (PSTR (" (line merge tolerance, mm)\r\n$40=") );
+    printFloat (settings.arc_tolerance); printPgmString (PSTR (" (arc tolerance, mm)\r\n") );
 #endif
 
 #ifdef LASER_CUTTER
@@ -245,9 +261,9 @@ void report_grbl_settings() {
     print_uint8_base2 (settings.invert_mask); printPgmString (PSTR (")\r\n$8=") );
     printInteger (settings.stepper_idle_lock_time);  printPgmString (PSTR (" (step idle delay, msec)\r\n$9=" ));
      // Convert from mm/min^2 for human readability
-    printFloat (settings.acceleration / (60 * 60) ); printPgmString (PSTR (" (acceleration, mm/sec^2)\r\n$10=") );
+    printFloat (settings.acceleration / (60 * 60) ); printPgmString (PSTR (" (path acceleration, mm/sec^2)\r\n$10=") );
     printFloat (settings.junction_deviation); printPgmString (PSTR (" (junction deviation, mm)\r\n$11=") );
-    printFloat (settings.mm_per_arc_segment); printPgmString (PSTR (" (arc, mm/segment)\r\n$12=") );
+    printFloat (settings.mm_per_arc_segment); printPgmString (PSTR (" (arc, min mm/segment)\r\n$12=") );
     printInteger (settings.n_arc_correction); printPgmString (PSTR (" (n-arc correction, int)\r\n$13=") );
     printInteger (settings.decimal_places); printPgmString (PSTR (" (n-decimals, int)\r\n$14=") );
     printInteger (bit_istrue (settings.flags, BITFLAG_REPORT_INCHES) ); printPgmString (PSTR (" (report inches, bool)\r\n$15=") );
@@ -262,7 +278,13 @@ void report_grbl_settings() {
     printInteger (settings.homing_debounce_delay); printPgmString (PSTR (" (homing debounce, msec)\r\n$23=") );
     printFloat (settings.homing_pulloff[X_AXIS]); printPgmString (PSTR (" (x, homing pull-off, mm)\r\n$24=") );
     printFloat (settings.homing_pulloff[Y_AXIS]); printPgmString (PSTR (" (y, homing pull-off, mm)\r\n$27=") );
-    printInteger (settings.tool_pwr);printPgmString (PSTR (" (laser power, 0...100)\r\n") );
+    printInteger (settings.tool_pwr);printPgmString (PSTR (" (laser power, 0...100)\r\n$31=") );
+    printFloat (settings.max_rate[X_AXIS]); printPgmString (PSTR (" (x, max rate, mm/min)\r\n$32=") );
+    printFloat (settings.max_rate[Y_AXIS]); printPgmString (PSTR (" (y, max rate, mm/min)\r\n$35=") );
+    printFloat (settings.axis_acceleration[X_AXIS] / (60 * 60) ); printPgmString (PSTR (" (x, acceleration, mm/sec^2)\r\n$36=") );
+    printFloat (settings.axis_acceleration[Y_AXIS] / (60 * 60) ); printPgmString (PSTR (" (y, acceleration, mm/sec^2)\r\n$39=") );
+    printFloat (settings.line_merge_tolerance); printPgmString (PSTR (" (line merge tolerance, mm)\r\n$40=") );
+    printFloat (settings.arc_tolerance); printPgmString (PSTR (" (arc tolerance, mm)\r\n") );
 #endif
 
 }
@@ -403,6 +425,13 @@ void report_gcode_modes() {
         printPgmString (PSTR (" G94") );
     }
 
+    if (gc.path_mode == PATH_MODE_BLEND) {
+        printPgmString (PSTR (" G64") );
+    }
+    else {
+        printPgmString (PSTR (" G61") );
+    }
+
     switch (gc.program_flow) {
         case PROGRAM_FLOW_RUNNING :
             printPgmString (PSTR (" M0") );
@@ -451,6 +480,120 @@ void report_startup_line (uint8_t n, char* line) {
     printPgmString (PSTR ("\r\n") );
 }
 
+// Prints the performance counters of the planner, the arcs and the stepper and the RAM left. Planner
+// averages are per planned block, arc averages per arc. The arc blocks are counted as they enter the
+// planner, the fixed length shows the segments of $11 for comparison. The max gap is the longest time
+// between two st_prep_buffer() calls while the steppers run, see SEGMENT_BUFFER_TIME. The stepper
+// interrupt times of the bresenham kernels need STEPPER_ISR_TIMING, 0 = kernel not run yet. The RAM never used is the smallest distance between the heap and the stack so far.
+void report_performance_counters () {
+    printPgmString (PSTR ("[PLAN:") );
+    printInteger (plan_stats.blocks_planned);
+    printPgmString (PSTR (" blocks,") );
+    if (plan_stats.blocks_planned > 0) {
+        printFloat ( (float) plan_stats.plan_time / plan_stats.blocks_planned);
+        printPgmString (PSTR (" us avg,") );
+        printInteger (plan_stats.plan_time_max);
+        printPgmString (PSTR (" us max,") );
+        printFloat ( (float) plan_stats.junction_time / plan_stats.blocks_planned);
+        printPgmString (PSTR (" us junction avg,") );
+        printFloat ( (float) plan_stats.blocks_replanned / plan_stats.blocks_planned);
+    } else {
+        printPgmString (PSTR ("0 us avg,0 us max,0 us junction avg,0") );
+    }
+    printPgmString (PSTR (" blocks replanned,") );
+    printInteger (plan_stats.slowdowns);
+    printPgmString (PSTR (" slowdowns]\r\n") );
+    
+    printPgmString (PSTR ("[ARC:") );
+    printInteger (mc_stats.arcs);
+    printPgmString (PSTR (" arcs,") );
+    if (mc_stats.arcs > 0) {
+        printFloat ( (float) mc_stats.arc_segments / mc_stats.arcs);
+        printPgmString (PSTR (" segments/arc,") );
+        printFloat ( (float) mc_stats.arc_blocks / mc_stats.arcs);
+        printPgmString (PSTR (" blocks/arc,") );
+        printFloat ( (float) mc_stats.arc_segments_fixed / mc_stats.arcs);
+    } else {
+        printPgmString (PSTR ("0 segments/arc,0 blocks/arc,0") );
+    }
+    printPgmString (PSTR (" segments/arc fixed length]\r\n") );
+
+    uint8_t sreg = SREG;
+    cli();
+    uint32_t underruns = st_stats.underruns;    // Counted by the stepper interrupt
+    SREG = sreg;
+    printPgmString (PSTR ("[STEP:") );
+    printInteger (st_stats.prep_gap_max);
+    printPgmString (PSTR (" us max gap,") );
+    printInteger (underruns);
+    printPgmString (PSTR (" underruns]\r\n") );
+
+#ifdef STEPPER_ISR_TIMING
+    printPgmString (PSTR ("[ISR:") );
+    for (uint8_t idx = 0; idx < 3; idx++) {
+        if (idx) { printPgmString (PSTR (",") ); }
+        cli();
+        uint16_t cycles = st_stats.isr_cycles_min[idx];
+        SREG = sreg;
+        printInteger (cycles);
+    }
+    printPgmString (PSTR (" cycles min XY,ZU,all]\r\n") );
+#endif
+
+    printPgmString (PSTR ("[RAM:") );
+    printInteger (sys_ram_free());
+    printPgmString (PSTR (" bytes free,") );
+    printInteger (sys_ram_unused());
+    printPgmString (PSTR (" bytes never used]\r\n") );
+}
+
+// Prints the throughput of a job processed from the sd card. Read rates are based on the time
+// spent in the sd reader, line rate on the total duration of the job. The line rates with and without
+// refresh are measured while a row of the progress screen is sent to the display and while not.
+void report_sd_statistics (uint32_t bytes, uint32_t lines, uint32_t read_us, uint32_t job_ms, float lines_refresh, float lines_plain) {
+    printPgmString (PSTR ("[SD:") );
+    printInteger (lines);
+    printPgmString (PSTR (" lines,") );
+    printInteger (bytes);
+    printPgmString (PSTR (" bytes,") );
+    printFloat (job_ms / 1000.0);
+    printPgmString (PSTR (" s,") );
+    if (read_us > 0) {
+        printInteger ( (uint32_t) (bytes * 1000000.0 / read_us) );
+    } else {
+        printInteger (0);
+    }
+    printPgmString (PSTR (" bytes/s read,") );
+    if (job_ms > 0) {
+        printFloat (lines * 1000.0 / job_ms);
+    } else {
+        printInteger (0);
+    }
+    printPgmString (PSTR (" lines/s,") );
+    printFloat (lines_refresh);
+    printPgmString (PSTR (" lines/s with refresh,") );
+    printFloat (lines_plain);
+    printPgmString (PSTR (" lines/s without refresh]\r\n") );
+}
+
+// Prints the job time estimate of a dry run. The total is the sum of cut, travel and dwell time,
+// the longest stall is the longest run of consecutive dwells.
+void report_estimate (float cut_s, float travel_s, float dwell_s, float stall_s, uint32_t blocks) {
+    printPgmString (PSTR ("[EST:") );
+    printFloat (cut_s + travel_s + dwell_s);
+    printPgmString (PSTR (" s total,") );
+    printFloat (cut_s);
+    printPgmString (PSTR (" s cut,") );
+    printFloat (travel_s);
+    printPgmString (PSTR (" s travel,") );
+    printFloat (dwell_s);
+    printPgmString (PSTR (" s dwell,") );
+    printFloat (stall_s);
+    printPgmString (PSTR (" s longest stall,") );
+    printInteger (blocks);
+    printPgmString (PSTR (" blocks]\r\n") );
+}
+
 // Prints real-time data. This function grabs a real-time snapshot of the stepper subprogram
 // and the actual location of the CNC machine. Users may change the following function to their
 // specific needs, but the desired real-time data report must be as short as possible. This is
@@ -465,7 +608,7 @@ void report_realtime_status() {
 /// 8c0
     int32_t current_position[N_AXIS]; // Copy current state of the system position variable
 
-    memcpy (current_position, sys.position, sizeof (sys.position) );
+    st_get_position (current_position);
     float print_position[N_AXIS];
     // Report current machine state
     switch (sys.state) {
@@ -491,6 +634,9 @@ void report_realtime_status() {
         case STATE_CHECK_MODE:
             printPgmString (PSTR ("<Check") );
             break;
+        case STATE_DRY_RUN:
+            printPgmString (PSTR ("<Estimate") );
+            break;
     }
     // Report machine position
 /// 8c1
@@ -524,6 +670,12 @@ void report_realtime_status() {
         if (i < N_AXIS-1)
             printPgmString (PSTR (",") );
     }
+
+    // Report feed and tool power overrides in percent
+    printPgmString (PSTR (",Ov:") );
+    printInteger (sys.feed_override);
+    printPgmString (PSTR (",") );
+    printInteger (sys.tool_override);
 /// 8c1
    // printPgmString (PSTR ("]>\r\n") );
      printPgmString (PSTR (">\r\n") );
@@ -60,4 +60,13 @@ void report_gcode_modes();
 // Prints startup line
 void report_startup_line(uint8_t n, char *line);
 
+// Prints the performance counters of the planner
+void report_performance_counters();
+
+// Prints the throughput of a job processed from the sd card
+void report_sd_statistics(uint32_t bytes, uint32_t lines, uint32_t read_us, uint32_t job_ms, float lines_refresh, float lines_plain);
+
+// Prints the job time estimate of a dry run in seconds
+void report_estimate(float cut_s, float travel_s, float dwell_s, float stall_s, uint32_t blocks);
+
 #endif
@@ -133,6 +133,14 @@ ISR(SERIAL_RX)
     case CMD_CYCLE_START:   sys.execute |= EXEC_CYCLE_START; break; // Set as true
     case CMD_FEED_HOLD:     sys.execute |= EXEC_FEED_HOLD; break; // Set as true
     case CMD_RESET:         mc_reset(); break; // Call motion control reset routine.
+    case CMD_FEED_OVR_RESET:        sys.override |= OVR_FEED_RESET; break;
+    case CMD_FEED_OVR_COARSE_PLUS:  sys.override |= OVR_FEED_COARSE_PLUS; break;
+    case CMD_FEED_OVR_COARSE_MINUS: sys.override |= OVR_FEED_COARSE_MINUS; break;
+    case CMD_FEED_OVR_FINE_PLUS:    sys.override |= OVR_FEED_FINE_PLUS; break;
+    case CMD_FEED_OVR_FINE_MINUS:   sys.override |= OVR_FEED_FINE_MINUS; break;
+    case CMD_TOOL_OVR_RESET:        sys.override |= OVR_TOOL_RESET; break;
+    case CMD_TOOL_OVR_COARSE_PLUS:  sys.override |= OVR_TOOL_COARSE_PLUS; break;
+    case CMD_TOOL_OVR_COARSE_MINUS: sys.override |= OVR_TOOL_COARSE_MINUS; break;
     default: // Write character to buffer
       next_head = rx_buffer_head + 1;
       if (next_head == RX_BUFFER_SIZE) { next_head = 0; }
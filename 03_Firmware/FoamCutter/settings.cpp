@@ -9,6 +9,7 @@
 #include "gcode.h"          // to_degrees()
 #include "defaults.h"       //
 #include "config.h"
+#include <stddef.h>         // offsetof()
 
 #if (U_AXIS != 3)
   #error
@@ -41,6 +42,45 @@ void write_global_settings()
   memcpy_to_eeprom_with_checksum(EEPROM_ADDR_GLOBAL, (char*)&settings, sizeof(settings_t));
 }
 
+// Resets the settings added after the given version to their defaults. Each version appended
+// its new settings to the end of the record.
+static void settings_reset_new(uint8_t version) {
+  if (version < 7) {                                                  // per axis limits
+    settings.max_rate[X_AXIS]           = DEFAULT_X_MAX_RATE;
+    settings.max_rate[Y_AXIS]           = DEFAULT_Y_MAX_RATE;
+    settings.axis_acceleration[X_AXIS]  = DEFAULT_X_ACCELERATION;
+    settings.axis_acceleration[Y_AXIS]  = DEFAULT_Y_ACCELERATION;
+#ifdef FOAM_CUTTER
+    settings.max_rate[U_AXIS]           = DEFAULT_U_MAX_RATE;
+    settings.max_rate[Z_AXIS]           = DEFAULT_Z_MAX_RATE;
+    settings.axis_acceleration[U_AXIS]  = DEFAULT_U_ACCELERATION;
+    settings.axis_acceleration[Z_AXIS]  = DEFAULT_Z_ACCELERATION;
+#endif
+#ifdef LASER_CUTTER
+    settings.max_rate[U_AXIS]           = DEFAULT_X_MAX_RATE;          // Defaults
+    settings.max_rate[Z_AXIS]           = DEFAULT_Y_MAX_RATE;          // Defaults
+    settings.axis_acceleration[U_AXIS]  = DEFAULT_X_ACCELERATION;      // Defaults
+    settings.axis_acceleration[Z_AXIS]  = DEFAULT_Y_ACCELERATION;      // Defaults
+#endif
+  }
+  if (version < 8) {                                                  // line merging
+    settings.line_merge_tolerance       = DEFAULT_LINE_MERGE_TOLERANCE;
+  }
+  if (version < 9) {                                                  // arc chord tolerance
+    settings.arc_tolerance              = DEFAULT_ARC_TOLERANCE;
+  }
+}
+
+// Size of the settings record stored by an older version
+static uint16_t settings_size(uint8_t version) {
+  switch (version) {
+    case 6:  return(offsetof(settings_t, max_rate));
+    case 7:  return(offsetof(settings_t, line_merge_tolerance));
+    case 8:  return(offsetof(settings_t, arc_tolerance));
+    default: return(sizeof(settings_t));
+  }
+}
+
 // Method to reset Grbl global settings back to defaults.
 void settings_reset(bool reset_all) {
   // Reset all settings or only the migration settings to the new version.
@@ -107,6 +147,7 @@ void settings_reset(bool reset_all) {
   settings.cutting_hor            = 0;
   settings.cutting_ver            = 0;
 #endif    
+  settings_reset_new(0);
  
   write_global_settings();
 }
@@ -156,6 +197,15 @@ uint8_t read_global_settings() {
     }
 #endif
   }
+  else if ((version >= 6) && (version < SETTINGS_VERSION)) {
+    // Older versions store the same record without the settings added later. Keep the stored 
+    // settings and add the new ones with their defaults.
+    if (!(memcpy_from_eeprom_with_checksum((char*)&settings, EEPROM_ADDR_GLOBAL, settings_size(version)))) {
+      return(false); // report error
+    } 
+    settings_reset_new(version);
+    write_global_settings();
+  }
   else {
     settings_reset(true);   
   }
@@ -168,6 +218,16 @@ uint8_t read_global_settings() {
 }
 
 
+// Axis of the per axis settings, numbered x, y, u, z like the steps per mm
+static uint8_t settings_axis_index(uint8_t n) {
+  switch (n) {
+    case 0:  return(X_AXIS);
+    case 1:  return(Y_AXIS);
+    case 2:  return(U_AXIS);
+    default: return(Z_AXIS);
+  }
+}
+
 // A helper method to set settings from command line
 uint8_t settings_store_global_setting(int parameter, float value) {
   switch(parameter) {
@@ -282,6 +342,26 @@ uint8_t settings_store_global_setting(int parameter, float value) {
     case 30:
       settings.cutting_ver = value;
       break;
+    case 31: case 32: case 33: case 34:   // max rate x, y, u, z
+      if (value <= 0.0)
+        return(STATUS_SETTING_VALUE_NEG);
+      settings.max_rate[settings_axis_index(parameter - SETTINGS_INDEX_MAX_RATE_X)] = value;
+      break;
+    case 35: case 36: case 37: case 38:   // acceleration x, y, u, z
+      if (value <= 0.0)
+        return(STATUS_SETTING_VALUE_NEG);
+      settings.axis_acceleration[settings_axis_index(parameter - SETTINGS_INDEX_ACCEL_X)] = value*60*60;
+      break; // Convert to mm/min^2 for grbl internal use.
+    case 39:
+      if (value < 0.0)
+        return(STATUS_SETTING_VALUE_NEG);
+      settings.line_merge_tolerance = value;
+      break;
+    case 40:
+      if (value <= 0.0)
+        return(STATUS_SETTING_VALUE_NEG);
+      settings.arc_tolerance = value;
+      break;
     default:
       return(STATUS_INVALID_STATEMENT);
   }
@@ -10,7 +10,7 @@
 
 // Version of the EEPROM data. Will be used to migrate existing data from older versions of Grbl
 // when firmware is upgraded. Always stored in byte 0 of eeprom
-#define SETTINGS_VERSION           6
+#define SETTINGS_VERSION           9
 
 // Define bit flag masks for the boolean settings in settings.flag.
 #define BITFLAG_REPORT_INCHES      bit(0)
@@ -60,6 +60,10 @@ typedef struct {
   float     fan_pwr;
   float     cutting_hor;
   float     cutting_ver;
+  float     max_rate[N_AXIS];       // Maximum rate of each axis in mm/min (since version 7)
+  float     axis_acceleration[N_AXIS];  // Acceleration of each axis in mm/min^2 (since version 7)
+  float     line_merge_tolerance;   // Chord tolerance for merging line segments in mm (since version 8)
+  float     arc_tolerance;          // Chord tolerance of the arc segments in mm (since version 9)
 //  uint8_t status_report_mask; // Mask to indicate desired report data.
 } settings_t;
 extern settings_t settings;
@@ -72,6 +76,8 @@ extern settings_t settings;
 #define SETTINGS_INDEX_PULLOFF_Z    26
 #define SETTINGS_CUTTING_HOR        29 
 #define SETTINGS_CUTTING_VER        30 
+#define SETTINGS_INDEX_MAX_RATE_X   31    // 31...34 max rate x, y, u, z
+#define SETTINGS_INDEX_ACCEL_X      35    // 35...38 acceleration x, y, u, z
 // Initialize the configuration subsystem (load settings from EEPROM)
 void settings_init();
 
@@ -15,17 +15,101 @@
 // Some useful constants
 #define TICKS_PER_MICROSECOND (F_CPU/1000000)
 #define CYCLES_PER_ACCELERATION_TICK ((TICKS_PER_MICROSECOND*1000000)/ACCELERATION_TICKS_PER_SECOND)
+#define CYCLES_PER_SEGMENT (TICKS_PER_MICROSECOND*1000L*SEGMENT_MAX_TIME)
+#define CYCLES_PER_BUFFER (TICKS_PER_MICROSECOND*1000L*SEGMENT_BUFFER_TIME)
 
-// Stepper state variable. Contains running data and trapezoid variables.
+// Segment flags
+#define SEGMENT_NEW_BLOCK bit(0)  // First segment of a block, starts the bresenham line tracer
+#define SEGMENT_END_BLOCK bit(1)  // Last segment of a block
+
+// Axis sets of the bresenham kernels, see st_step_axes()
+#define AXES_XY  (bit(X_AXIS)|bit(Y_AXIS))
+#define AXES_ZU  (bit(Z_AXIS)|bit(U_AXIS))
+#define AXES_ALL (AXES_XY|AXES_ZU)
+
+#ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+  // AMASS levels. Below the step rate of a level the stepper interrupt runs 2^level times per step event.
+  #define MAX_AMASS_LEVEL 3
+  #define AMASS_LEVEL1 (F_CPU/8000) // Cycles per step event, defined as F_CPU/(cutoff frequency in Hz)
+  #define AMASS_LEVEL2 (F_CPU/4000)
+  #define AMASS_LEVEL3 (F_CPU/2000)
+#endif
+
+// Stepper block. The data of a planner block traced by the stepper interrupt, copied when the block is
+// cut into segments. The planner block is discarded after its last segment is prepared.
+typedef struct {
+  uint8_t  direction_bits;
+  uint16_t steps_x, steps_y, steps_z, steps_u;
+  uint16_t step_event_count;          // Step events of the whole block, also after a feed hold
+  int8_t   tool_state;
+  uint8_t  axes;                      // Axis set of the bresenham kernel, AXES_*
+#ifdef LASER_RASTER
+  uint8_t  *raster;
+  uint8_t  raster_count;
+#endif
+} st_block_t;
+static st_block_t st_block_buffer[SEGMENT_BUFFER_SIZE];
+
+// Step segment. A number of step events at a constant rate, the timer setup and the tool power are
+// computed by the main program, so the stepper interrupt only loads them.
+typedef struct {
+  uint16_t n_step;                    // Number of stepper interrupts of the segment
+  uint16_t ceiling;                   // Timer 1 ceiling (OCR1A) of the step rate
+  uint8_t  prescaler;                 // Timer 1 prescaler (CS1x bits) of the step rate
+  uint8_t  st_block_index;            // Stepper block traced by the segment
+  uint8_t  tool_pwr;                  // Tool power 0...TOOL_PWR_MAX, M4 follows the rate of the segment
+  uint8_t  flags;                     // SEGMENT_* flags
+#ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+  uint8_t  amass_level;               // Stepper interrupts per step event: 2^amass_level
+#endif
+} segment_t;
+static segment_t segment_buffer[SEGMENT_BUFFER_SIZE];
+static volatile uint8_t segment_buffer_tail;  // Index of the segment in execution, moved by the stepper interrupt
+static volatile uint8_t segment_buffer_head;  // Index of the next segment to be prepared
+static uint8_t segment_next_head;             // Index of the next segment buffer head
+static volatile uint8_t prep_end;             // True, if no more segments follow: no block left or feed hold complete
+
+st_statistics_t st_stats;                     // Stepper performance counters
+
+// Stepper state variable. Contains the running data of the stepper interrupt.
 typedef struct {
   // Used by the bresenham line algorithm
   int32_t counter_x,        // Counter variables for the bresenham line tracer
           counter_y,
           counter_z,
           counter_u;  
+  uint32_t steps_x,         // Bresenham increments of the segment in execution, scaled to its AMASS level
+           steps_y,
+           steps_z,
+           steps_u;
+  uint32_t step_event_count;             // Bresenham range of the block in execution, scaled to MAX_AMASS_LEVEL
+
+  segment_t *exec_segment;               // The segment in execution, NULL if none
+  st_block_t *exec_block;                // The block traced by the segment in execution, NULL after its end
+  uint16_t step_count;                   // Step events left in the segment in execution
+  uint8_t tool_pwr;                      // Tool power of the segment in execution
+  uint16_t step_events;                  // Step events of the block before the segment in execution
+  uint8_t starving;                      // True, if the segment buffer ran empty before the end of the blocks
+#ifdef LASER_RASTER
+  uint8_t *raster_pixel;                 // Pixel of the raster line at the current step event
+  uint8_t raster_left;                   // Pixels left including the current one, 0 = no raster line
+  int32_t raster_counter;                // Counter of the bresenham line tracer, which spreads the pixels
+                                         // over the step events of the block
+  uint32_t raster_steps;                 // Bresenham increment of the pixels, scaled like steps_x
+#endif
+} stepper_t;
+static stepper_t st;
 
-  uint32_t event_count;
-  uint32_t step_events_completed;  // The number of step events left in current motion
+// Prep state variable. Contains the trapezoid generator variables of the block cut into segments.
+typedef struct {
+  block_t *block;                        // The planner block cut into segments, NULL if none
+  uint8_t st_block_index;                // Stepper block of the planner block
+  uint8_t flags;                         // Flags of the next segment
+  uint8_t hold_complete;                 // True, if the feed hold deceleration is prepared completely
+  uint16_t step_events_completed;        // The number of step events prepared of the block
+  uint32_t buffer_cycles;                // The machine cycles of the segments from buffer_tail to the buffer head
+  uint8_t buffer_tail;                   // The oldest segment in buffer_cycles, follows the segment buffer tail
+  uint32_t call_time;                    // Time of the last st_prep_buffer() call while the steppers run in usec, 0 if none
 
   // Used by the trapezoid generator
   uint32_t cycles_per_step_event;        // The number of machine cycles between each step event
@@ -33,16 +117,30 @@ typedef struct {
                                               // pace without allocating a separate timer
   uint32_t trapezoid_adjusted_rate;      // The current rate of step_events according to the trapezoid generator
   uint32_t min_safe_rate;  // Minimum safe rate for full deceleration rate reduction step. Otherwise halves step_rate.
-} stepper_t;
-
-static stepper_t st;
-static block_t *current_block;  // A pointer to the block currently being traced
+  uint32_t tool_rate_scale;              // M4: tool power per step rate with 24 bit fraction, 0 for a constant power
+  uint16_t ceiling;                      // Timer 1 ceiling of the current rate
+  uint8_t prescaler;                     // Timer 1 prescaler of the current rate
+  uint8_t tool_pwr;                      // Tool power at the current rate
+#ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+  uint8_t amass_level;                   // AMASS level of the current rate
+#endif
+#ifdef S_CURVE_ACCELERATION
+  uint32_t ramp_start_rate;              // The rate at the start of the current S-curve ramp
+  uint32_t ramp_delta_rate;              // The rate change of the current S-curve ramp
+  uint16_t ramp_tick;                    // The acceleration ticks since the start of the current S-curve ramp
+#endif
+} st_prep_t;
+static st_prep_t prep;
 
 // Used by the stepper driver interrupt
 static uint8_t step_pulse_time; // Step pulse reset time after step rise
 static uint8_t out_bits;        // The next stepping-bits to be output
 static volatile uint8_t busy;   // True when SIG_OUTPUT_COMPARE1A is being serviced. Used to avoid retriggering that handler.
 
+// Used by the idle lock of st_go_idle()
+static volatile uint8_t st_disable_pending;  // True, if the steppers are disabled at st_disable_time
+static uint32_t st_disable_time;             // Time in msec (sys_millis) to disable the steppers
+
 #if STEP_PULSE_DELAY > 0
   static uint8_t step_bits;  // Stores out_bits output to complete the step pulse delay
 #endif
@@ -63,14 +161,31 @@ static volatile uint8_t busy;   // True when SIG_OUTPUT_COMPARE1A is being servi
 //  step_events_completed reaches block->decelerate_after after which it decelerates until the trapezoid generator is reset.
 //  The slope of acceleration is always +/- block->rate_delta and is applied at a constant rate following the midpoint rule
 //  by the trapezoid generator, which is called ACCELERATION_TICKS_PER_SECOND times per second.
+//  With S_CURVE_ACCELERATION the rate follows an S-curve from the start to the end of each ramp in the same number of
+//  acceleration ticks (block->accelerate_ticks, block->decelerate_ticks), computed by the planner.
+//  The trapezoid generator runs in the main program: st_prep_buffer() cuts the blocks into segments of
+//  a constant rate, which end at the acceleration ticks, and the stepper interrupt only executes them.
 
 static void set_step_events_per_minute(uint32_t steps_per_minute);
 
+// M4 runs the tool with a power proportional to the step rate, full power at the nominal rate. The
+// factor tool_pwr/nominal_rate is computed once per block as an integer with a 24 bit fraction, so
+// every rate change of the trapezoid generator updates the power with one multiplication.
+static uint32_t tool_rate_scale(block_t *block)
+{
+  if ((block->tool_state != 4) || (block->flags & BLOCK_FLAG_DWELL)) { return(0); }
+  #ifdef LASER_RASTER
+    if (block->raster_count) { return(0); }     // The pixels set the power
+  #endif
+  return( max(1, ((uint32_t)block->tool_pwr << 24)/block->nominal_rate) );
+}
+
 // Stepper state initialization. Cycle should only start if the st.cycle_start flag is
 // enabled. Startup init and limits call this function but shouldn't start the cycle.
 void st_wake_up()
 {
   // Enable steppers by resetting the stepper disable port
+    st_disable_pending = false;   // Cancel a pending idle disable
     uint8_t val = 0;
     if (bit_istrue(settings.flags,BITFLAG_INVERT_ST_ENABLE)) {
     val |= (1<<STEPPERS_DISABLE_BIT);
@@ -102,59 +217,273 @@ void st_wake_up()
 // Stepper shutdown
 void st_go_idle()
 {
-  uint8_t val = 0;
   // Disable stepper driver interrupt
   TIMSK1 &= ~(1<<OCIE1A);
   // Disable steppers only upon system alarm activated or by user setting to not be kept enabled.
   if ((settings.stepper_idle_lock_time != 0xff) || bit_istrue(sys.execute,EXEC_ALARM)) {
     // Force stepper dwell to lock axes for a defined amount of time to ensure the axes come to a complete
-    // stop and not drift from residual inertial forces at the end of the last movement.
-    delay_ms(settings.stepper_idle_lock_time);
-    
+    // stop and not drift from residual inertial forces at the end of the last movement. The main program
+    // disables the steppers after the time in st_idle_lock(), so neither the stepper interrupt nor the
+    // main program wait for it.
+    st_disable_time = sys_millis() + settings.stepper_idle_lock_time;
+    st_disable_pending = true;
+  }
+  else {
+    rampsWriteDisable(0);
+  }
+}
+// manual Stepper shutdown
+void st_force_idle()
+{
+  // Disable stepper driver interrupt
+  TIMSK1 &= ~(1<<OCIE1A);
+  st_disable_time = sys_millis() + settings.stepper_idle_lock_time;
+  st_disable_pending = true;
+}
+
+// Disables the steppers, when the idle lock time of st_go_idle() or st_force_idle() is over. Called by
+// the main program. st_wake_up() cancels the pending disable, if new blocks arrive before.
+void st_idle_lock()
+{
+  if (!st_disable_pending) { return; }
+  uint8_t sreg = SREG;
+  cli();
+  if (st_disable_pending && ((int32_t)(sys_millis() - st_disable_time) >= 0)) {
+    st_disable_pending = false;
+    uint8_t val = 0;
     if (bit_istrue(settings.flags,BITFLAG_INVERT_ST_ENABLE)) {
       val &= ~(1<<STEPPERS_DISABLE_BIT);
     }
     else {
       val |= (1<<STEPPERS_DISABLE_BIT);
     }
+    rampsWriteDisable(val);
   }
-  rampsWriteDisable(val);
+  SREG = sreg;
 }
-// manual Stepper shutdown
-void st_force_idle()
+
+#ifdef S_CURVE_ACCELERATION
+// Returns the rate change of an S-curve ramp of delta_rate after tick of ticks acceleration ticks. The ramp
+// follows the smoothstep polynomial 3x^2-2x^3, the acceleration rises and falls linearly and has its peak
+// of 1.5 x the mean acceleration in the middle of the ramp. Integer math with 16 bit fractions.
+static uint32_t s_curve_rate(uint32_t delta_rate, uint16_t tick, uint16_t ticks)
 {
-  uint8_t val = 0;
-  // Disable stepper driver interrupt
-  TIMSK1 &= ~(1<<OCIE1A);
-   delay_ms(settings.stepper_idle_lock_time);  
-  if (bit_istrue(settings.flags,BITFLAG_INVERT_ST_ENABLE)) {
-    val &= ~(1<<STEPPERS_DISABLE_BIT);
+  if (tick >= ticks) { return(delta_rate); }
+  uint32_t x = ((uint32_t)tick << 16)/ticks;            // 0...1
+  uint32_t x2 = (x*x) >> 16;                            // x^2
+  uint32_t s = (x2*((3*65536UL-2*x) >> 2)) >> 14;       // x^2*(3-2x)
+  return( (((delta_rate >> 8)*s) >> 8) + (((delta_rate & 0xFF)*s) >> 16) );
+}
+#endif
+
+// Executes one acceleration tick of the trapezoid generator in the trapezoid phase of the step event
+// completed: changes the rate by rate_delta, along the S-curve of the ramp or ramps to the nominal rate
+// after a feed override. During a feed hold the rate decelerates until it reaches zero.
+static void prep_tick(block_t *block, uint16_t completed)
+{
+  if (sys.state == STATE_HOLD) {
+    // If deceleration complete, end the segments. The stepper interrupt shuts down after this one.
+    if (prep.trapezoid_adjusted_rate <= block->rate_delta) {
+      prep.hold_complete = true;
+      return;
+    }
+    prep.trapezoid_adjusted_rate -= block->rate_delta;
+  }
+  else if (completed < block->accelerate_until) {
+    #ifdef S_CURVE_ACCELERATION
+      prep.ramp_tick++;
+      prep.trapezoid_adjusted_rate = prep.ramp_start_rate +
+        s_curve_rate(prep.ramp_delta_rate, prep.ramp_tick, block->accelerate_ticks);
+    #else
+      prep.trapezoid_adjusted_rate += block->rate_delta;
+    #endif
+    if (prep.trapezoid_adjusted_rate >= block->nominal_rate) {
+      // Reached nominal rate a little early. Cruise at nominal rate until decelerate_after.
+      prep.trapezoid_adjusted_rate = block->nominal_rate;
+    }
+  }
+  else if (completed > block->decelerate_after) {
+    #ifdef S_CURVE_ACCELERATION
+      prep.ramp_tick++;
+      prep.trapezoid_adjusted_rate = prep.ramp_start_rate -
+        s_curve_rate(prep.ramp_delta_rate, prep.ramp_tick, block->decelerate_ticks);
+    #else
+      // NOTE: We will only do a full speed reduction if the result is more than the minimum safe
+      // rate, initialized in trapezoid reset as 1.5 x rate_delta. Otherwise, reduce the speed by
+      // half increments until finished. The half increments are guaranteed not to exceed the
+      // CNC acceleration limits, because they will never be greater than rate_delta. This catches
+      // small errors that might leave steps hanging after the last trapezoid tick or a very slow
+      // step rate at the end of a full stop deceleration in certain situations. The half rate
+      // reductions should only be called once or twice per block and create a nice smooth
+      // end deceleration.
+      if (prep.trapezoid_adjusted_rate > prep.min_safe_rate) {
+        prep.trapezoid_adjusted_rate -= block->rate_delta;
+      }
+      else {
+        prep.trapezoid_adjusted_rate >>= 1; // Bit shift divide by 2
+      }
+    #endif
+    if (prep.trapezoid_adjusted_rate < block->final_rate) {
+      // Reached final rate a little early. Cruise to end of block at final rate.
+      prep.trapezoid_adjusted_rate = block->final_rate;
+    }
+  }
+  else if (prep.trapezoid_adjusted_rate < block->nominal_rate) {
+    prep.trapezoid_adjusted_rate = min(prep.trapezoid_adjusted_rate + block->rate_delta, block->nominal_rate);
   }
   else {
-    val |= (1<<STEPPERS_DISABLE_BIT);
+    prep.trapezoid_adjusted_rate = max(prep.trapezoid_adjusted_rate - min(prep.trapezoid_adjusted_rate,
+                                       (uint32_t)block->rate_delta), block->nominal_rate);
   }
-  rampsWriteDisable(val);
+  set_step_events_per_minute(prep.trapezoid_adjusted_rate);
 }
 
-// This function determines an acceleration velocity change every CYCLES_PER_ACCELERATION_TICK by
-// keeping track of the number of elapsed cycles during a de/ac-celeration. The code assumes that
-// step_events occur significantly more often than the acceleration velocity iterations.
-inline static uint8_t iterate_trapezoid_cycle_counter()
+// Executes the trapezoid generator for a step event in the trapezoid phase of completed and returns the
+// machine cycles of the step event. The acceleration ticks are counted on the cycles of the step events.
+// A tick within the step event changes the rate from there on, the rest of the step event takes the time
+// at the new rate. So a step event slower than a tick, like the first steps from rest, follows the
+// acceleration in time and does not wait for its end to apply the ticks it spans.
+static uint32_t prep_step_cycles(block_t *block, uint16_t completed)
 {
-  st.trapezoid_tick_cycle_counter += st.cycles_per_step_event;
-  if(st.trapezoid_tick_cycle_counter > CYCLES_PER_ACCELERATION_TICK) {
-    st.trapezoid_tick_cycle_counter -= CYCLES_PER_ACCELERATION_TICK;
-    return(true);
+  uint32_t cycles = 0;
+  uint32_t left = prep.cycles_per_step_event;   // Cycles of the rest of the step event at the current rate
+  for (;;) {
+    uint32_t tick_cycles = 0;
+    if (prep.trapezoid_tick_cycle_counter < CYCLES_PER_ACCELERATION_TICK) {
+      tick_cycles = CYCLES_PER_ACCELERATION_TICK - prep.trapezoid_tick_cycle_counter;
+    }
+    if (left <= tick_cycles) {
+      prep.trapezoid_tick_cycle_counter += left;
+      return(cycles + left);
+    }
+    cycles += tick_cycles;
+    left -= tick_cycles;
+    prep.trapezoid_tick_cycle_counter = 0;
+    uint32_t step_cycles = prep.cycles_per_step_event;
+    prep_tick(block, completed);
+    if (prep.hold_complete) { return(cycles + left); }
+    left = (float)left*prep.cycles_per_step_event/step_cycles;
   }
-  else {
-    return(false);
+}
+
+// Adds the given steps of the axes to position in the directions of the block
+static void st_add_block_steps(int32_t *position, st_block_t *block, uint16_t x, uint16_t y, uint16_t z, uint16_t u)
+{
+  uint8_t bits = block->direction_bits;
+  if (bits & (1<<X_DIRECTION_BIT)) { position[X_AXIS] -= x; } else { position[X_AXIS] += x; }
+  if (bits & (1<<Y_DIRECTION_BIT)) { position[Y_AXIS] -= y; } else { position[Y_AXIS] += y; }
+  if (bits & (1<<Z_DIRECTION_BIT)) { position[Z_AXIS] -= z; } else { position[Z_AXIS] += z; }
+  if (bits & (1<<U_DIRECTION_BIT)) { position[U_AXIS] -= u; } else { position[U_AXIS] += u; }
+}
+
+// Returns the steps of an axis with steps of the block traced so far, from the bresenham counter. The
+// counter started at -range/2 and got steps per 1/2^MAX_AMASS_LEVEL step event, minus range per step:
+// counter = progress*steps - range/2 - taken*range with progress = events + fraction/2^MAX_AMASS_LEVEL.
+// Divided by 2^MAX_AMASS_LEVEL it stays in 32 bits.
+static uint16_t st_block_steps(uint16_t steps, uint16_t step_event_count, uint32_t range, int32_t counter,
+                               uint16_t events, uint8_t fraction)
+{
+  #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+    int32_t rest = (int32_t)fraction*steps - (int32_t)(range >> 1) - counter;  // Multiple of 2^MAX_AMASS_LEVEL
+    uint32_t taken = (uint32_t)events*steps + rest/(1<<MAX_AMASS_LEVEL);
+  #else
+    uint32_t taken = (uint32_t)events*steps - (range >> 1) - counter;
+  #endif
+  return(taken/step_event_count);
+}
+
+// Copies the real-time machine position in steps to position. The stepper interrupt only adds the steps
+// of a block to sys.position at its end, the steps of the block in execution are rebuilt here from a
+// consistent snapshot of the bresenham state. Called by the main program, e.g. for the status report.
+void st_get_position(int32_t *position)
+{
+  int32_t counter[N_AXIS];
+  uint16_t events = 0;
+  uint8_t fraction = 0;
+  uint8_t sreg = SREG;
+  cli();
+  memcpy(position, sys.position, sizeof(sys.position));
+  st_block_t *block = st.exec_block;
+  uint32_t range = st.step_event_count;
+  if (block != NULL) {
+    counter[X_AXIS] = st.counter_x;
+    counter[Y_AXIS] = st.counter_y;
+    counter[Z_AXIS] = st.counter_z;
+    counter[U_AXIS] = st.counter_u;
+    events = st.step_events;
+    if (st.exec_segment != NULL) {
+      // Step events of the segment in execution
+      uint16_t ticks = st.exec_segment->n_step - st.step_count;
+      #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+        uint8_t level = st.exec_segment->amass_level;
+        events += ticks >> level;
+        fraction = (ticks & ((1<<level)-1)) << (MAX_AMASS_LEVEL-level);
+      #else
+        events += ticks;
+      #endif
+    }
+  }
+  SREG = sreg;
+  if (block == NULL) { return; }
+
+  uint16_t n = block->step_event_count;
+  st_add_block_steps(position, block, 
+                     st_block_steps(block->steps_x, n, range, counter[X_AXIS], events, fraction),
+                     st_block_steps(block->steps_y, n, range, counter[Y_AXIS], events, fraction),
+                     st_block_steps(block->steps_z, n, range, counter[Z_AXIS], events, fraction),
+                     st_block_steps(block->steps_u, n, range, counter[U_AXIS], events, fraction));
+}
+
+// The bresenham kernel of the stepper interrupt for the axis set AXES. Returns the step and direction
+// bits of the step event. The axes not in AXES are left out at compile time, an idle axis does not
+// add and compare its 32 bit counter with every step event. The stepper interrupt selects the kernel
+// per block, so the 2 axis moves of the laser and the foam blocks with one tower idle (AXES_XY,
+// AXES_ZU) skip two of the four counters. Counted on the AVR code of the kernels (llc -march=avr
+// -mcpu=atmega2560 -O2, instruction timings of the ATmega2560, without the kernel switch), a step event
+// takes 80 cycles with AXES_XY and AXES_ZU and 158 with AXES_ALL, if no axis steps, and 123 (AXES_XY),
+// 125 (AXES_ZU) and 245 (AXES_ALL), if all of them step. An idle tower saves 78 to 122 cycles, 4.9 to
+// 7.6 usec at 16 MHz. The code of avr-gcc may differ by a few cycles per axis, STEPPER_ISR_TIMING
+// measures the kernels of the build on the machine. The laser has no AXES_ZU kernel, it only moves Z
+// and U, if the g-code asks for it. The machine position is not updated per step, see st_get_position().
+template <uint8_t AXES> static inline uint8_t st_step_axes(uint8_t bits)
+{
+  if (AXES & bit(X_AXIS)) {
+    st.counter_x += st.steps_x;
+    if (st.counter_x > 0) {
+      bits |= (1<<X_STEP_BIT);
+      st.counter_x -= st.step_event_count;
+    }
+  }
+  if (AXES & bit(Y_AXIS)) {
+    st.counter_y += st.steps_y;
+    if (st.counter_y > 0) {
+      bits |= (1<<Y_STEP_BIT);
+      st.counter_y -= st.step_event_count;
+    }
+  }
+  if (AXES & bit(Z_AXIS)) {
+    st.counter_z += st.steps_z;
+    if (st.counter_z > 0) {
+      bits |= (1<<Z_STEP_BIT);
+      st.counter_z -= st.step_event_count;
+    }
   }
+  if (AXES & bit(U_AXIS)) {
+    st.counter_u += st.steps_u;
+    if (st.counter_u > 0) {
+      bits |= (1<<U_STEP_BIT);
+      st.counter_u -= st.step_event_count;
+    }
+  }
+  return(bits);
 }
 
-// "The Stepper Driver Interrupt" - This timer interrupt is the workhorse of Grbl. It is executed at the rate set with
-// config_step_timer. It pops blocks from the block_buffer and executes them by pulsing the stepper pins appropriately.
-// It is supported by The Stepper Port Reset Interrupt which it uses to reset the stepper port after each pulse.
-// The bresenham line tracer algorithm controls all three stepper outputs simultaneously with these two interrupts.
+// "The Stepper Driver Interrupt" - This timer interrupt is the workhorse of Grbl. It is executed at the rate of
+// the segment in execution. It pops the segments prepared by st_prep_buffer() and executes them by pulsing the
+// stepper pins appropriately. It is supported by The Stepper Port Reset Interrupt which it uses to reset the
+// stepper port after each pulse. The bresenham line tracer algorithm controls all stepper outputs simultaneously
+// with these two interrupts. The rate, the timer setup and the tool power are computed by the main program, so
+// the handler is short and takes the same time for every step event.
 ISR(TIMER1_COMPA_vect)
 {
   if (busy) { return; } // The busy-flag is used to avoid reentering this interrupt
@@ -180,181 +509,143 @@ ISR(TIMER1_COMPA_vect)
   // step interrupt compare and will always finish before returning to the main program.
   sei();
 
-  // If there is no current block, attempt to pop one from the buffer
-  if (current_block == NULL) {
-    // Anything in the buffer? If so, initialize next motion.
-    current_block = plan_get_current_block();
-    if (current_block != NULL) {
-      if (sys.state == STATE_CYCLE) {
-        // During feed hold, do not update rate and trap counter. Keep decelerating.
-        st.trapezoid_adjusted_rate = current_block->initial_rate;
-        set_step_events_per_minute(st.trapezoid_adjusted_rate); // Initialize cycles_per_step_event
-        st.trapezoid_tick_cycle_counter = CYCLES_PER_ACCELERATION_TICK/2; // Start halfway for midpoint rule.
+  #ifdef STEPPER_ISR_TIMING
+    uint8_t kernel = 0xff;   // Index of the kernel in st_stats.isr_cycles_min, none if a segment is popped
+  #endif
+
+  // If there is no segment in execution, attempt to pop one from the segment buffer
+  if (st.exec_segment == NULL) {
+    if (segment_buffer_head != segment_buffer_tail) {
+      st.exec_segment = &segment_buffer[segment_buffer_tail];
+      st.starving = false;
+      // Set the rate of the segment
+      TCCR1B = (TCCR1B & ~(0x07<<CS10)) | (st.exec_segment->prescaler<<CS10);
+      OCR1A = st.exec_segment->ceiling;
+      st.step_count = st.exec_segment->n_step;
+      uint8_t pwr = st.exec_segment->tool_pwr;
+      if (st.exec_segment->flags & SEGMENT_NEW_BLOCK) {
+        // Initialize the bresenham line tracer of the next block
+        st.exec_block = &st_block_buffer[st.exec_segment->st_block_index];
+        st.step_events = 0;
+        #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+          st.step_event_count = (uint32_t)st.exec_block->step_event_count << MAX_AMASS_LEVEL;
+        #else
+          st.step_event_count = st.exec_block->step_event_count;
+          st.steps_x = st.exec_block->steps_x;
+          st.steps_y = st.exec_block->steps_y;
+          st.steps_z = st.exec_block->steps_z;
+          st.steps_u = st.exec_block->steps_u;
+          #ifdef LASER_RASTER
+            st.raster_steps = st.exec_block->raster_count;
+          #endif
+        #endif
+        st.counter_x = -(st.step_event_count >> 1);
+        st.counter_y = st.counter_x;
+        st.counter_z = st.counter_x;
+        st.counter_u = st.counter_x;
+        #ifdef LASER_RASTER
+          st.raster_pixel = st.exec_block->raster;
+          st.raster_left = st.exec_block->raster_count;
+          st.raster_counter = -(int32_t)st.step_event_count;
+          if (st.raster_left) { pwr = *st.raster_pixel; }
+        #endif
+        // Controll the Tool on the first step event of the block
+        tool_isr(st.exec_block->tool_state, pwr);
+      }
+      else if (pwr != st.tool_pwr) {
+        // M4: the power follows the rate of the segment
+        tool_isr(st.exec_block->tool_state, pwr);
       }
-      st.min_safe_rate = current_block->rate_delta + (current_block->rate_delta >> 1); // 1.5 x rate_delta
-      st.counter_x = -(current_block->step_event_count >> 1);
-      st.counter_y = st.counter_x;
-      st.counter_z = st.counter_x;
-
-      st.counter_u = st.counter_x;
-      st.event_count = current_block->step_event_count;
-      st.step_events_completed = 0;
+      st.tool_pwr = st.exec_segment->tool_pwr;
+      #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+        // Scale the bresenham increments to the AMASS level of the segment. The range is scaled to the 
+        // max. level, so a step event adds the same to the counters at every level.
+        uint8_t amass_shift = MAX_AMASS_LEVEL - st.exec_segment->amass_level;
+        st.steps_x = (uint32_t)st.exec_block->steps_x << amass_shift;
+        st.steps_y = (uint32_t)st.exec_block->steps_y << amass_shift;
+        st.steps_z = (uint32_t)st.exec_block->steps_z << amass_shift;
+        st.steps_u = (uint32_t)st.exec_block->steps_u << amass_shift;
+        #ifdef LASER_RASTER
+          st.raster_steps = (uint32_t)st.exec_block->raster_count << amass_shift;
+        #endif
+      #endif
     }
     else {
-      st_go_idle();
-      bit_true(sys.execute,EXEC_CYCLE_STOP); // Flag main program for cycle end
+      // The segment buffer is empty. At the end of the blocks or of a feed hold deceleration shutdown
+      // the steppers. Otherwise the main program is late with the next segment, step nothing and check
+      // again with the next interrupt.
+      if (prep_end) {
+        st_go_idle();
+        bit_true(sys.execute,EXEC_CYCLE_STOP); // Flag main program for cycle end
+      }
+      else if (!st.starving) {
+        st.starving = true;
+        st_stats.underruns++;
+      }
+      out_bits = (out_bits ^ settings.invert_mask) & ~STEP_MASK;
     }
   }
 
-  if (current_block != NULL) {
+  if (st.exec_segment != NULL) {
+    st_block_t *block = st.exec_block;
     // Execute step displacement profile by bresenham line algorithm
-    out_bits = current_block->direction_bits;
-    st.counter_x += current_block->steps_x;
-    if (st.counter_x > 0) {
-      out_bits |= (1<<X_STEP_BIT);
-      st.counter_x -= st.event_count;
-      if (out_bits & (1<<X_DIRECTION_BIT))
-    sys.position[X_AXIS]--;
-      else
-    sys.position[X_AXIS]++;
-    }
-    st.counter_y += current_block->steps_y;
-    if (st.counter_y > 0) {
-      out_bits |= (1<<Y_STEP_BIT);
-      st.counter_y -= st.event_count;
-      if (out_bits & (1<<Y_DIRECTION_BIT))
-    sys.position[Y_AXIS]--;
-      else
-    sys.position[Y_AXIS]++;
+    switch (block->axes) {
+      case AXES_XY: out_bits = st_step_axes<AXES_XY>(block->direction_bits); break;
+      #ifdef FOAM_CUTTER
+      case AXES_ZU: out_bits = st_step_axes<AXES_ZU>(block->direction_bits); break;
+      #endif
+      default: out_bits = st_step_axes<AXES_ALL>(block->direction_bits);
     }
-    st.counter_z += current_block->steps_z;
-    if (st.counter_z > 0) {
-      out_bits |= (1<<Z_STEP_BIT);
-      st.counter_z -= st.event_count;
-      if (out_bits & (1<<Z_DIRECTION_BIT))
-    sys.position[Z_AXIS]--;
-      else
-        sys.position[Z_AXIS]++;
-    }
-    st.counter_u += current_block->steps_u;
-    if (st.counter_u > 0) {
-      out_bits |= (1<<U_STEP_BIT);
-      st.counter_u -= st.event_count;
-      if (out_bits & (1<<U_DIRECTION_BIT))
-    sys.position[U_AXIS]--;
-      else
-        sys.position[U_AXIS]++;
-    }
-
-    // Controll the Tool on the first step event.
-    if (st.step_events_completed == 0) {
-      tool_isr(current_block->tool_state, current_block->tool_pwr); 
-    }
-    // TODO: integrate tool_isr into de/ac-celeration events
-    
-    st.step_events_completed++; // Iterate step events
+    #ifdef STEPPER_ISR_TIMING
+      if (st.step_count != st.exec_segment->n_step) {
+        kernel = (block->axes == AXES_XY) ? 0 : ((block->axes == AXES_ZU) ? 1 : 2);
+      }
+    #endif
 
-    // While in block steps, check for de/ac-celeration events and execute them accordingly.
-    if (st.step_events_completed < current_block->step_event_count) {
-      
-      if (sys.state == STATE_HOLD) {
-        // Check for and execute feed hold by enforcing a steady deceleration from the moment of
-        // execution. The rate of deceleration is limited by rate_delta and will never decelerate
-        // faster or slower than in normal operation. If the distance required for the feed hold
-        // deceleration spans more than one block, the initial rate of the following blocks are not
-        // updated and deceleration is continued according to their corresponding rate_delta.
-        // NOTE: The trapezoid tick cycle counter is not updated intentionally. This ensures that
-        // the deceleration is smooth regardless of where the feed hold is initiated and if the
-        // deceleration distance spans multiple blocks.
-        if ( iterate_trapezoid_cycle_counter() ) {
-          // If deceleration complete, set system flags and shutdown steppers.
-          if (st.trapezoid_adjusted_rate <= current_block->rate_delta) {
-            // Just go idle. Do not NULL current block. The bresenham algorithm variables must
-            // remain intact to ensure the stepper path is exactly the same. Feed hold is still
-            // active and is released after the buffer has been reinitialized.
-            st_go_idle();
-            bit_true(sys.execute,EXEC_CYCLE_STOP); // Flag main program that feed hold is complete.
-          }
-          else {
-            st.trapezoid_adjusted_rate -= current_block->rate_delta;
-            set_step_events_per_minute(st.trapezoid_adjusted_rate);
-          }
+    #ifdef LASER_RASTER
+      // A raster line switches to the next pixel after step_event_count/raster_count step events. The 
+      // pixels are traced like a further axis of the bresenham line algorithm.
+      if (st.raster_left) {
+        st.raster_counter += st.raster_steps;
+        if (st.raster_counter >= 0) {
+          st.raster_counter -= st.step_event_count;
+          st.raster_pixel++;
+          if (--st.raster_left) { tool_isr(block->tool_state, *st.raster_pixel); }
         }
-
       }
-      else {
-        // The trapezoid generator always checks step event location to ensure de/ac-celerations are
-        // executed and terminated at exactly the right time. This helps prevent over/under-shooting
-        // the target position and speed.
-        // NOTE: By increasing the ACCELERATION_TICKS_PER_SECOND in config.h, the resolution of the
-        // discrete velocity changes increase and accuracy can increase as well to a point. Numerical
-        // round-off errors can effect this, if set too high. This is important to note if a user has
-        // very high acceleration and/or feedrate requirements for their machine.
-        if (st.step_events_completed < current_block->accelerate_until) {
-          // Iterate cycle counter and check if speeds need to be increased.
-          if ( iterate_trapezoid_cycle_counter() ) {
-            st.trapezoid_adjusted_rate += current_block->rate_delta;
-            if (st.trapezoid_adjusted_rate >= current_block->nominal_rate) {
-              // Reached nominal rate a little early. Cruise at nominal rate until decelerate_after.
-              st.trapezoid_adjusted_rate = current_block->nominal_rate;
-            }
-            set_step_events_per_minute(st.trapezoid_adjusted_rate);
-          }
-        }
-        else if (st.step_events_completed >= current_block->decelerate_after) {
-          // Reset trapezoid tick cycle counter to make sure that the deceleration is performed the
-          // same every time. Reset to CYCLES_PER_ACCELERATION_TICK/2 to follow the midpoint rule for
-          // an accurate approximation of the deceleration curve. For triangle profiles, down count
-          // from current cycle counter to ensure exact deceleration curve.
-          if (st.step_events_completed == current_block-> decelerate_after) {
-            if (st.trapezoid_adjusted_rate == current_block->nominal_rate) {
-              st.trapezoid_tick_cycle_counter = CYCLES_PER_ACCELERATION_TICK/2; // Trapezoid profile
-            }
-            else {
-              st.trapezoid_tick_cycle_counter = CYCLES_PER_ACCELERATION_TICK-st.trapezoid_tick_cycle_counter; // Triangle profile
-            }
-          }
-          else {
-            // Iterate cycle counter and check if speeds need to be reduced.
-            if ( iterate_trapezoid_cycle_counter() ) {
-              // NOTE: We will only do a full speed reduction if the result is more than the minimum safe
-              // rate, initialized in trapezoid reset as 1.5 x rate_delta. Otherwise, reduce the speed by
-              // half increments until finished. The half increments are guaranteed not to exceed the
-              // CNC acceleration limits, because they will never be greater than rate_delta. This catches
-              // small errors that might leave steps hanging after the last trapezoid tick or a very slow
-              // step rate at the end of a full stop deceleration in certain situations. The half rate
-              // reductions should only be called once or twice per block and create a nice smooth
-              // end deceleration.
-              if (st.trapezoid_adjusted_rate > st.min_safe_rate) {
-                st.trapezoid_adjusted_rate -= current_block->rate_delta;
-              }
-              else {
-                st.trapezoid_adjusted_rate >>= 1; // Bit shift divide by 2
-              }
-              if (st.trapezoid_adjusted_rate < current_block->final_rate) {
-                // Reached final rate a little early. Cruise to end of block at final rate.
-                st.trapezoid_adjusted_rate = current_block->final_rate;
-              }
-              set_step_events_per_minute(st.trapezoid_adjusted_rate);
-            }
-          }
-        }
-        else {
-          // No accelerations. Make sure we cruise exactly at the nominal rate.
-          if (st.trapezoid_adjusted_rate != current_block->nominal_rate) {
-            st.trapezoid_adjusted_rate = current_block->nominal_rate;
-            set_step_events_per_minute(st.trapezoid_adjusted_rate);
-          }
-        }
+    #endif
+
+    // If the segment is finished, pop it from the buffer. The last segment of a block adds the steps
+    // of the block to the machine position and frees its pixels.
+    if (--st.step_count == 0) {
+      #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+        st.step_events += st.exec_segment->n_step >> st.exec_segment->amass_level;
+      #else
+        st.step_events += st.exec_segment->n_step;
+      #endif
+      if (st.exec_segment->flags & SEGMENT_END_BLOCK) {
+        st_add_block_steps(sys.position, block, block->steps_x, block->steps_y, block->steps_z, block->steps_u);
+        st.exec_block = NULL;
+        #ifdef LASER_RASTER
+          if (block->raster_count) { plan_discard_raster(block->raster, block->raster_count); }
+        #endif
       }
-    }
-    else {
-      // If current block is finished, reset pointer
-      current_block = NULL;
-      plan_discard_current_block();
+      st.exec_segment = NULL;
+      uint8_t tail = segment_buffer_tail + 1;
+      if (tail == SEGMENT_BUFFER_SIZE) { tail = 0; }
+      segment_buffer_tail = tail;
     }
   }
   out_bits ^= settings.invert_mask;  // Apply step and direction invert mask //425
+  #ifdef STEPPER_ISR_TIMING
+    // The timer counts the cycles since the compare match with the prescaler 1
+    if ((kernel != 0xff) && ((TCCR1B & (0x07<<CS10)) == (1<<CS10))) {
+      uint16_t cycles = TCNT1;
+      if (!st_stats.isr_cycles_min[kernel] || (cycles < st_stats.isr_cycles_min[kernel])) {
+        st_stats.isr_cycles_min[kernel] = cycles;
+      }
+    }
+  #endif
   busy = false;
 }
 
@@ -388,9 +679,18 @@ ISR(TIMER2_OVF_vect)
 // Reset and clear stepper subsystem variables
 void st_reset()
 {
+  // Keep the steps of a block stopped by a feed hold or a reset in the machine position
+  st_get_position(sys.position);
   memset(&st, 0, sizeof(st));
+  memset(&prep, 0, sizeof(prep));
+  memset(&st_stats, 0, sizeof(st_stats)); // Clear performance counters
+  segment_buffer_tail = 0;
+  segment_buffer_head = 0;
+  segment_next_head = 1;
+  prep_end = false;
   set_step_events_per_minute(MINIMUM_STEPS_PER_MINUTE);
-  current_block = NULL;
+  TCCR1B = (TCCR1B & ~(0x07<<CS10)) | (prep.prescaler<<CS10);
+  OCR1A = prep.ceiling;
   busy = false;
 }
 
@@ -426,9 +726,9 @@ void st_init()
   st_go_idle();
 }
 
-// Configures the prescaler and ceiling of timer 1 to produce the given rate as accurately as possible.
+// Computes the prescaler and ceiling of timer 1 to produce the given rate as accurately as possible.
 // Returns the actual number of cycles per interrupt
-static uint32_t config_step_timer(uint32_t cycles)
+static uint32_t config_step_timer(uint32_t cycles, uint16_t *timer_ceiling, uint8_t *timer_prescaler)
 {
   uint16_t ceiling;
   uint8_t prescaler;
@@ -468,18 +768,356 @@ static uint32_t config_step_timer(uint32_t cycles)
     prescaler = 5;
     actual_cycles = 0xffff * 1024;
   }
-  // Set prescaler
-  TCCR1B = (TCCR1B & ~(0x07<<CS10)) | (prescaler<<CS10);
-  // Set ceiling
-  OCR1A = ceiling;
+  // The stepper interrupt sets them with the next segment
+  *timer_prescaler = prescaler;
+  *timer_ceiling = ceiling;
   return(actual_cycles);
 }
 
+#ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+// Returns the AMASS level of a step event of the given cycles. Below AMASS_LEVEL1 the stepper interrupt
+// runs 2^level times per step event.
+static uint8_t amass_level(uint32_t cycles)
+{
+  if (cycles < AMASS_LEVEL1) { return(0); }
+  if (cycles < AMASS_LEVEL2) { return(1); }
+  if (cycles < AMASS_LEVEL3) { return(2); }
+  return(3);
+}
+#endif
+
 static void set_step_events_per_minute(uint32_t steps_per_minute)
 {
   if (steps_per_minute < MINIMUM_STEPS_PER_MINUTE)
   steps_per_minute = MINIMUM_STEPS_PER_MINUTE;
-  st.cycles_per_step_event = config_step_timer((TICKS_PER_MICROSECOND*1000000*60)/steps_per_minute);
+  uint32_t cycles = (TICKS_PER_MICROSECOND*1000000*60)/steps_per_minute;
+  #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+    prep.amass_level = amass_level(cycles);
+    prep.cycles_per_step_event = config_step_timer(cycles >> prep.amass_level, &prep.ceiling, &prep.prescaler) << prep.amass_level;
+  #else
+    prep.cycles_per_step_event = config_step_timer(cycles, &prep.ceiling, &prep.prescaler);
+  #endif
+
+  // M4: scale the tool power to the new rate
+  if (prep.tool_rate_scale && (prep.block != NULL)) {
+    uint8_t pwr = prep.block->tool_pwr;
+    if (steps_per_minute < prep.block->nominal_rate) {
+      pwr = (steps_per_minute*prep.tool_rate_scale + (1UL << 23)) >> 24;
+    }
+    prep.tool_pwr = pwr;
+  }
+}
+
+// Returns the machine cycles the stepper interrupt takes for a segment
+static uint32_t segment_cycles(segment_t *segment)
+{
+  uint8_t prescaler = segment->prescaler;      // 1...5: 1, 8, 64, 256, 1024
+  uint8_t shift = (prescaler < 4) ? 3*(prescaler-1) : 2*prescaler;
+  return( ((uint32_t)segment->n_step*segment->ceiling) << shift );
+}
+
+// Takes the segments of the block in preparation back from the segment buffer, which the stepper
+// interrupt has not started yet, so a feed hold or a feed override changes the rate within one
+// acceleration tick and not after the buffer. The segment at the buffer tail may be in execution and
+// is kept, as are the segments of the blocks before, whose planner blocks are discarded already. They
+// last SEGMENT_BUFFER_TIME at most. The trapezoid generator continues at the rate of the last segment
+// kept, at the start of the block with its initial rate. The segments are kept and false is returned,
+// if limit or more step events of the block remain prepared.
+static uint8_t prep_rewind(uint16_t limit)
+{
+  if (prep.block == NULL) { return(false); }
+  uint16_t completed = prep.step_events_completed;
+  uint32_t cycles = 0;
+  uint8_t flags = 0;
+  uint8_t sreg = SREG;
+  cli();
+  uint8_t tail = segment_buffer_tail;
+  uint8_t head = segment_buffer_head;
+  while (head != tail) {
+    uint8_t index = (head ? head : SEGMENT_BUFFER_SIZE) - 1;
+    segment_t *segment = &segment_buffer[index];
+    if ((index == tail) || (segment->st_block_index != prep.st_block_index)) { break; }
+    #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+      completed -= segment->n_step >> segment->amass_level;
+    #else
+      completed -= segment->n_step;
+    #endif
+    cycles += segment_cycles(segment);
+    flags |= segment->flags;
+    head = index;
+  }
+  if (completed >= limit) {
+    SREG = sreg;
+    return(false);
+  }
+  if (head == segment_buffer_head) {
+    SREG = sreg;
+    return(true);   // Nothing to take back
+  }
+  segment_buffer_head = head;
+  SREG = sreg;
+  segment_next_head = head + 1;
+  if (segment_next_head == SEGMENT_BUFFER_SIZE) { segment_next_head = 0; }
+  prep.buffer_cycles -= cycles;
+  prep.step_events_completed = completed;
+  if (flags & SEGMENT_NEW_BLOCK) { prep.flags = SEGMENT_NEW_BLOCK; }
+
+  if ((completed == 0) && (sys.state != STATE_HOLD)) {
+    prep.trapezoid_adjusted_rate = prep.block->initial_rate;
+    prep.trapezoid_tick_cycle_counter = CYCLES_PER_ACCELERATION_TICK/2;
+  }
+  else {
+    // The rate of the last segment kept, from its timer setup
+    segment_t *segment = &segment_buffer[(head ? head : SEGMENT_BUFFER_SIZE) - 1];
+    #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+      uint32_t step_cycles = segment_cycles(segment)/(segment->n_step >> segment->amass_level);
+    #else
+      uint32_t step_cycles = segment_cycles(segment)/segment->n_step;
+    #endif
+    prep.trapezoid_adjusted_rate = (TICKS_PER_MICROSECOND*1000000*60)/step_cycles;
+  }
+  set_step_events_per_minute(prep.trapezoid_adjusted_rate);
+  return(true);
+}
+
+// Loads the planner block at the buffer tail for cutting it into segments. Returns false, if the
+// planner buffer is empty.
+static uint8_t prep_load_block()
+{
+  block_t *block = plan_get_current_block();
+  if (block == NULL) { return(false); }
+  prep.block = block;
+
+  // Copy the data of the bresenham line tracer
+  if (++prep.st_block_index == SEGMENT_BUFFER_SIZE) { prep.st_block_index = 0; }
+  st_block_t *st_block = &st_block_buffer[prep.st_block_index];
+  st_block->direction_bits = block->direction_bits;
+  st_block->steps_x = block->steps_x;
+  st_block->steps_y = block->steps_y;
+  st_block->steps_z = block->steps_z;
+  st_block->steps_u = block->steps_u;
+  st_block->step_event_count = block->step_event_count;
+  st_block->tool_state = block->tool_state;
+  st_block->axes = AXES_ALL;
+  if (!block->steps_z && !block->steps_u) { st_block->axes = AXES_XY; }
+  #ifdef FOAM_CUTTER
+    else if (!block->steps_x && !block->steps_y) { st_block->axes = AXES_ZU; }
+  #endif
+  #ifdef LASER_RASTER
+    st_block->raster = block->raster;
+    st_block->raster_count = block->raster_count;
+  #endif
+
+  prep.flags = SEGMENT_NEW_BLOCK;
+  prep.step_events_completed = 0;
+  prep.tool_rate_scale = tool_rate_scale(block);
+  prep.tool_pwr = block->tool_pwr;
+  if (sys.state != STATE_HOLD) {
+    // During feed hold, do not update rate and trap counter. Keep decelerating.
+    prep.trapezoid_adjusted_rate = block->initial_rate;
+    prep.trapezoid_tick_cycle_counter = CYCLES_PER_ACCELERATION_TICK/2; // Start halfway for midpoint rule.
+  }
+  set_step_events_per_minute(prep.trapezoid_adjusted_rate); // Initialize cycles_per_step_event
+  prep.min_safe_rate = block->rate_delta + (block->rate_delta >> 1); // 1.5 x rate_delta
+  #ifdef S_CURVE_ACCELERATION
+    // The acceleration ramp runs from the initial rate to the cruise rate.
+    prep.ramp_start_rate = block->initial_rate;
+    prep.ramp_delta_rate = min(block->nominal_rate-block->initial_rate,
+                               (uint32_t)block->rate_delta*block->accelerate_ticks);
+    prep.ramp_tick = 0;
+  #endif
+  prep_end = false;
+  return(true);
+}
+
+// Fills the segment buffer with the planner blocks. Called by the main program in 
+// protocol_execute_runtime(), as often as the stepper needs new segments. A segment ends at the next
+// rate change of the trapezoid generator, at a change of the trapezoid phase or after SEGMENT_MAX_TIME.
+void st_prep_buffer()
+{
+  // The longest time between two calls while the steppers run, the segment buffer must cover it
+  if ((sys.state == STATE_CYCLE) || ((sys.state == STATE_HOLD) && !prep_end)) {
+    uint32_t time = sys_micros();
+    if (prep.call_time && (time - prep.call_time > st_stats.prep_gap_max)) {
+      st_stats.prep_gap_max = time - prep.call_time;
+    }
+    prep.call_time = time;
+  }
+  else {
+    prep.call_time = 0;
+  }
+  if ((sys.state != STATE_QUEUED) && (sys.state != STATE_CYCLE) && (sys.state != STATE_HOLD)) { return; }
+  // A feed hold is complete or the blocks ended during the deceleration
+  if ((sys.state == STATE_HOLD) && prep_end) { return; }
+
+  for (;;) {
+    if (prep.hold_complete) { return; }
+    // Take the segments the stepper interrupt has finished out of the buffer time
+    uint8_t tail = segment_buffer_tail;
+    while (prep.buffer_tail != tail) {
+      prep.buffer_cycles -= segment_cycles(&segment_buffer[prep.buffer_tail]);
+      if (++prep.buffer_tail == SEGMENT_BUFFER_SIZE) { prep.buffer_tail = 0; }
+    }
+    // The next planner block is loaded right after the last, so the block following the prepared
+    // segments is always the block in execution for the planner and the feed override.
+    if (prep.block == NULL) {
+      if (!prep_load_block()) {
+        prep_end = true;
+        return;
+      }
+    }
+    if (segment_next_head == tail) { return; }  // Segment buffer full
+    // Enough time buffered after the segment at the tail, which may be in execution already. Only
+    // these segments are prepared ahead, so a feed hold or override acts on the rest. See prep_rewind().
+    if ((tail != segment_buffer_head) &&
+        (prep.buffer_cycles - segment_cycles(&segment_buffer[tail]) >= CYCLES_PER_BUFFER)) { return; }
+
+    block_t *block = prep.block;
+
+    // Execute the trapezoid generator for the first step event of the segment. The rate of the
+    // segment is the rate after its first step event. A step event with an acceleration tick is a
+    // segment of its own with the cycles of both rates, see prep_step_cycles().
+    uint16_t completed = prep.step_events_completed + 1;
+    uint32_t step_cycles = 0;   // Cycles of the first step event, 0 = at the rate of the segment
+    if (completed < block->step_event_count) {
+
+      if (sys.state == STATE_HOLD) {
+        // Check for and execute feed hold by enforcing a steady deceleration from the moment of
+        // execution. The rate of deceleration is limited by rate_delta and will never decelerate
+        // faster or slower than in normal operation. If the distance required for the feed hold
+        // deceleration spans more than one block, the initial rate of the following blocks are not
+        // updated and deceleration is continued according to their corresponding rate_delta.
+        // NOTE: The trapezoid tick cycle counter is not updated intentionally. This ensures that
+        // the deceleration is smooth regardless of where the feed hold is initiated and if the
+        // deceleration distance spans multiple blocks. If the deceleration is complete, the
+        // segments end. The bresenham algorithm variables remain intact to ensure the stepper path
+        // is exactly the same. Feed hold is still active and is released after the buffer has been
+        // reinitialized.
+        step_cycles = prep_step_cycles(block, completed);
+      }
+      // The trapezoid generator always checks step event location to ensure de/ac-celerations are
+      // executed and terminated at exactly the right time. This helps prevent over/under-shooting
+      // the target position and speed.
+      // NOTE: By increasing the ACCELERATION_TICKS_PER_SECOND in config.h, the resolution of the
+      // discrete velocity changes increase and accuracy can increase as well to a point. Numerical
+      // round-off errors can effect this, if set too high. This is important to note if a user has
+      // very high acceleration and/or feedrate requirements for their machine.
+      else if (completed == block->decelerate_after) {
+        // Reset trapezoid tick cycle counter to make sure that the deceleration is performed the
+        // same every time. Reset to CYCLES_PER_ACCELERATION_TICK/2 to follow the midpoint rule for
+        // an accurate approximation of the deceleration curve. For triangle profiles, down count
+        // from current cycle counter to ensure exact deceleration curve.
+        if (prep.trapezoid_adjusted_rate == block->nominal_rate) {
+          prep.trapezoid_tick_cycle_counter = CYCLES_PER_ACCELERATION_TICK/2; // Trapezoid profile
+        }
+        else {
+          prep.trapezoid_tick_cycle_counter = CYCLES_PER_ACCELERATION_TICK-prep.trapezoid_tick_cycle_counter; // Triangle profile
+        }
+        #ifdef S_CURVE_ACCELERATION
+          // The deceleration ramp runs from the current rate to the final rate.
+          prep.ramp_start_rate = prep.trapezoid_adjusted_rate;
+          prep.ramp_delta_rate = 0;
+          if (prep.ramp_start_rate > block->final_rate) {
+            prep.ramp_delta_rate = prep.ramp_start_rate-block->final_rate;
+          }
+          prep.ramp_tick = 0;
+        #endif
+      }
+      else if ((completed < block->accelerate_until) || (completed > block->decelerate_after)) {
+        step_cycles = prep_step_cycles(block, completed);
+      }
+      // No accelerations. Make sure we cruise exactly at the nominal rate. A feed override changes
+      // the nominal rate of the block in execution, the rate ramps to it with the acceleration of
+      // the block. See st_set_nominal_rate().
+      else if ((prep.trapezoid_adjusted_rate + block->rate_delta < block->nominal_rate) ||
+               (prep.trapezoid_adjusted_rate > block->nominal_rate + block->rate_delta)) {
+        step_cycles = prep_step_cycles(block, completed);
+      }
+      else if (prep.trapezoid_adjusted_rate != block->nominal_rate) {
+        prep.trapezoid_adjusted_rate = block->nominal_rate;
+        set_step_events_per_minute(prep.trapezoid_adjusted_rate);
+      }
+      if (step_cycles == prep.cycles_per_step_event) { step_cycles = 0; }   // No tick in the step event
+    }
+
+    // Add the following step events up to the next rate change, the next change of the trapezoid phase
+    // or SEGMENT_MAX_TIME. The cycle counter is iterated over them as the trapezoid generator would.
+    uint32_t n_step = 1;
+    completed++;
+    if (!step_cycles && !prep.hold_complete && (completed < block->step_event_count)) {
+      uint16_t steps = 0;     // Step events of the trapezoid phase
+      uint8_t ticks = true;   // The phase iterates the cycle counter
+      if (sys.state == STATE_HOLD) {
+        steps = block->step_event_count - completed;
+      }
+      else if (completed < block->accelerate_until) {
+        steps = block->accelerate_until - completed;
+      }
+      else if (completed > block->decelerate_after) {
+        steps = block->step_event_count - completed;
+      }
+      else if (completed < block->decelerate_after) {
+        steps = block->decelerate_after - completed;
+        if (prep.trapezoid_adjusted_rate == block->nominal_rate) { ticks = false; }
+        else if ((prep.trapezoid_adjusted_rate + block->rate_delta >= block->nominal_rate) &&
+                 (prep.trapezoid_adjusted_rate <= block->nominal_rate + block->rate_delta)) { steps = 0; }
+      }
+      steps = min(steps, block->step_event_count - completed);  // A resumed dwell keeps its decelerate_after
+      uint32_t max_steps = CYCLES_PER_SEGMENT/prep.cycles_per_step_event;
+      if (ticks) {
+        uint32_t tick_steps = 0;
+        if (prep.trapezoid_tick_cycle_counter < CYCLES_PER_ACCELERATION_TICK) {
+          tick_steps = (CYCLES_PER_ACCELERATION_TICK-prep.trapezoid_tick_cycle_counter)/prep.cycles_per_step_event;
+        }
+        max_steps = min(max_steps, tick_steps+1);
+      }
+      if (max_steps > 1) {
+        n_step += min(max_steps-1, steps);
+        if (ticks) { prep.trapezoid_tick_cycle_counter += (n_step-1)*prep.cycles_per_step_event; }
+      }
+    }
+
+    segment_t *segment = &segment_buffer[segment_buffer_head];
+    if (step_cycles) {
+      // One step event with an acceleration tick
+      #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+        segment->amass_level = amass_level(step_cycles);
+        segment->n_step = 1 << segment->amass_level;
+        config_step_timer(step_cycles >> segment->amass_level, &segment->ceiling, &segment->prescaler);
+      #else
+        segment->n_step = 1;
+        config_step_timer(step_cycles, &segment->ceiling, &segment->prescaler);
+      #endif
+    }
+    else {
+      #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+        segment->n_step = n_step << prep.amass_level;
+        segment->amass_level = prep.amass_level;
+      #else
+        segment->n_step = n_step;
+      #endif
+      segment->ceiling = prep.ceiling;
+      segment->prescaler = prep.prescaler;
+    }
+    segment->st_block_index = prep.st_block_index;
+    segment->tool_pwr = prep.tool_pwr;
+    segment->flags = prep.flags;
+    prep.flags = 0;
+    prep.buffer_cycles += segment_cycles(segment);
+    prep.step_events_completed += n_step;
+    if (prep.step_events_completed == block->step_event_count) { segment->flags |= SEGMENT_END_BLOCK; }
+
+    // Push the segment to the stepper interrupt
+    segment_buffer_head = segment_next_head;
+    if (++segment_next_head == SEGMENT_BUFFER_SIZE) { segment_next_head = 0; }
+    if (prep.hold_complete) { prep_end = true; }
+
+    // If the block is cut completely, discard it
+    if (prep.step_events_completed == block->step_event_count) {
+      prep.block = NULL;
+      plan_discard_current_block();
+    }
+  }
 }
 
 // Planner external interface to start stepper interrupt and execute the blocks in queue. Called
@@ -488,6 +1126,7 @@ void st_cycle_start()
 {
   if (sys.state == STATE_QUEUED) {
     sys.state = STATE_CYCLE;
+    st_prep_buffer();   // Prepare the first segments
     st_wake_up();
   }
 }
@@ -498,7 +1137,45 @@ void st_feed_hold()
   if (sys.state == STATE_CYCLE) {
     sys.state = STATE_HOLD;
     sys.auto_start = false; // Disable planner auto start upon feed hold.
+    prep_rewind(0xffff);    // Decelerate from the segment in execution on
+  }
+}
+
+// Changes the nominal rate of the block in execution for the feed override. Returns false, if no
+// block is in execution. The block in execution is the block cut into segments, its segments not
+// started yet are prepared again with the new rate, see prep_rewind(). The exit rate of the block is
+// kept, so the following blocks are not affected. The cruise phase ramps from the current rate to the
+// new nominal rate and the deceleration starts in time to reach the exit rate. The rate is kept, if the rest of the block 
+// is too short for the deceleration or the deceleration has begun already. During a feed hold only 
+// the nominal rate is changed, the block is replanned on resume.
+uint8_t st_set_nominal_rate(uint32_t nominal_rate)
+{
+  block_t *block = prep.block;
+  if (block == NULL) { return(false); }
+  if ((block->flags & BLOCK_FLAG_DWELL) || (nominal_rate == block->nominal_rate)) { return(true); }
+  if (sys.state == STATE_HOLD) {
+    block->nominal_rate = nominal_rate;
+    prep.tool_rate_scale = tool_rate_scale(block);
+    return(true);
   }
+
+  // Deceleration from the higher of the current and the new rate to the exit rate. The current rate
+  // may rise by one more acceleration tick until the block is updated.
+  nominal_rate = max(nominal_rate, block->final_rate);
+  float acceleration = (float)block->rate_delta*(60*ACCELERATION_TICKS_PER_SECOND); // (step/min^2)
+  float decelerate_rate = max(prep.trapezoid_adjusted_rate + block->rate_delta, nominal_rate);
+  float decelerate_steps = ceil((decelerate_rate*decelerate_rate - (float)block->final_rate*block->final_rate)/(2*acceleration));
+  if (decelerate_steps >= block->step_event_count) { return(true); }
+  uint16_t decelerate_after = block->step_event_count - (uint16_t)decelerate_steps;
+
+  if (prep_rewind(min(decelerate_after, block->decelerate_after))) {
+    block->nominal_rate = nominal_rate;
+    block->accelerate_until = 0;           // Ramp in the cruise phase
+    block->decelerate_after = decelerate_after;
+    prep.tool_rate_scale = tool_rate_scale(block);
+    set_step_events_per_minute(prep.trapezoid_adjusted_rate);  // M4: power of the new nominal rate
+  }
+  return(true);
 }
 
 // Reinitializes the cycle plan and stepper system after a feed hold for a resume. Called by
@@ -508,15 +1185,32 @@ void st_feed_hold()
 // Only the planner de/ac-celerations profiles and stepper rates have been updated.
 void st_cycle_reinitialize()
 {
-  if (current_block != NULL) {
-    // Replan buffer from the feed hold stop location.
-    plan_cycle_reinitialize(current_block->step_event_count - st.step_events_completed);
-    // Update initial rate and timers after feed hold.
-    st.trapezoid_adjusted_rate = 0; // Resumes from rest
-    set_step_events_per_minute(st.trapezoid_adjusted_rate);
-    st.trapezoid_tick_cycle_counter = CYCLES_PER_ACCELERATION_TICK/2; // Start halfway for midpoint rule.
-    st.step_events_completed = 0;
+  if (prep.hold_complete) {
+    prep.hold_complete = false;
+    if ((prep.block != NULL) || prep_load_block()) {
+      // Replan buffer from the feed hold stop location.
+      plan_cycle_reinitialize(prep.block->step_event_count - prep.step_events_completed);
+      // Update initial rate and timers after feed hold.
+      prep.trapezoid_adjusted_rate = 0; // Resumes from rest
+      set_step_events_per_minute(prep.trapezoid_adjusted_rate);
+      prep.trapezoid_tick_cycle_counter = CYCLES_PER_ACCELERATION_TICK/2; // Start halfway for midpoint rule.
+      prep.step_events_completed = 0;
+      #ifdef S_CURVE_ACCELERATION
+        // Restart the acceleration ramp of the replanned block from rest.
+        prep.ramp_start_rate = 0;
+        prep.ramp_delta_rate = min(prep.block->nominal_rate,
+                                   (uint32_t)prep.block->rate_delta*prep.block->accelerate_ticks);
+        prep.ramp_tick = 0;
+      #endif
+      prep_end = false;
+      sys.state = STATE_QUEUED;
+      return;
+    }
+  }
+  if ((prep.block != NULL) || (plan_get_current_block() != NULL)) {
+    // Blocks added after the segments ran out start from rest
     sys.state = STATE_QUEUED;
+    if (sys.auto_start) { st_cycle_start(); }
   }
   else
     sys.state = STATE_IDLE;
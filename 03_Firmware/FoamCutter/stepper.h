@@ -2,6 +2,17 @@
 #define stepper_h
 
 #include <avr/io.h>
+#include "config.h"    // STEPPER_ISR_TIMING
+
+// Stepper performance counters, cleared by st_reset() and reported with $P
+typedef struct {
+  uint32_t prep_gap_max;              // Longest time between two st_prep_buffer() calls while the steppers run in usec
+  uint32_t underruns;                 // Number of times the segment buffer ran empty before the end of the blocks
+#ifdef STEPPER_ISR_TIMING
+  uint16_t isr_cycles_min[3];         // Shortest stepper interrupt of the kernels AXES_XY, AXES_ZU, AXES_ALL in cycles, 0 if none
+#endif
+} st_statistics_t;
+extern st_statistics_t st_stats;
 
 // Initialize and setup the stepper motor subsystem
 void st_init();
@@ -15,9 +26,20 @@ void st_go_idle();
 // Forces the steppers to go idle, use for manual idle command
 void st_force_idle();
 
+// Disables the steppers after the idle lock time of st_go_idle() and st_force_idle(). Called by the
+// main program.
+void st_idle_lock();
+
 // Reset the stepper subsystem variables
 void st_reset();
 
+// Copies the real-time machine position in steps, including the steps of the block in execution.
+void st_get_position(int32_t *position);
+
+// Fills the step segment buffer of the stepper interrupt with the planner blocks. Called by the
+// main program.
+void st_prep_buffer();
+
 // Notify the stepper subsystem to start executing the g-code program in buffer.
 void st_cycle_start();
 
@@ -27,4 +49,8 @@ void st_cycle_reinitialize();
 // Initiates a feed hold of the running program
 void st_feed_hold();
 
+// Changes the nominal rate of the block in execution for the feed override. Returns false, if no 
+// block is in execution.
+uint8_t st_set_nominal_rate(uint32_t nominal_rate);
+
 #endif
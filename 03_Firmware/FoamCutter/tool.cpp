@@ -3,6 +3,10 @@
 #include "settings.h"
 #include "gcode.h"
 
+static uint16_t pwm_scale;                            // pwm per TOOL_PWR_MAX with 8 bit fraction, incl. override
+static int8_t   isr_state;                            // last state and power set by tool_isr()
+static uint8_t  isr_pwr;
+
 
 void tool_off() {
   gc.tool_state         = 5;                          // M5
@@ -15,6 +19,9 @@ void tool_off() {
 
 void tool_init() {
   gc.tool_pwr           = settings.tool_pwr;          // start with default power for tool
+  isr_state             = 5;
+  isr_pwr               = 0;
+  tool_set_override(sys.tool_override);
 
 #ifdef FOAM_CUTTER
   SET_OUTPUT(PIN_LED_HOTWIRE);
@@ -78,22 +85,30 @@ void tool_run(int8_t state, float pwr) {            // state: 3 = M3   on
 }
 
 
-void tool_isr(int8_t state, float pwr) {
+// Sets the tool power override. The factor from TOOL_PWR_MAX to the pwm is computed here, so tool_isr()
+// scales without division. The power of the running block changes at once.
+void tool_set_override(int16_t percent) {
+  sys.tool_override     = max(TOOL_OVERRIDE_MIN, min(TOOL_OVERRIDE_MAX, percent));
+  pwm_scale             = ((uint32_t)sys.tool_override*2047*256 + 100*TOOL_PWR_MAX/2)/(100*TOOL_PWR_MAX);
   
-  uint16_t utemp = 0;
-  float    ftemp = 0;
+  if (sys.state == STATE_CYCLE) {
+    uint8_t sreg = SREG;
+    cli();
+    tool_isr(isr_state, isr_pwr);
+    SREG = sreg;
+  }
+}
 
-  ftemp   = pwr;
-  ftemp  *= 2047;
-  ftemp  /= 100;
+
+void tool_isr(int8_t state, uint8_t pwr) {
   
-  if (ftemp > 2047) {
+  // scale 0...TOOL_PWR_MAX with the override to the pwm 0...2047
+  uint32_t utemp = ((uint32_t)pwr*pwm_scale + 128) >> 8;
+  if (utemp > 2047) {
     utemp = 2047;
-  } else if (ftemp < 0) {
-    utemp = 0;
-  } else {
-    utemp = (uint16_t)ftemp; 
   }
+  isr_state = state;
+  isr_pwr   = pwr;
   
 
   switch (state) {      // [M3,M4,M5]
@@ -103,9 +118,7 @@ void tool_isr(int8_t state, float pwr) {
                 WRITE(PIN_LED_HOTWIRE, 1); 
 #endif
                 break;
-    case 5:     TCCR4A                &= 0b11110011;                // Disable PWM. Output voltage is zero.
-                return;
-                break;
+    case 5:                                                         // Same as tool_off()
     default:    TCCR4A                &= 0b11110011;                // Disable PWM. Output voltage is zero.
 #ifdef FOAM_CUTTER
                 WRITE(PIN_LED_HOTWIRE, 0); 
@@ -4,6 +4,8 @@
 #include "fastio.h"
 #include "config.h"
 
+#define TOOL_PWR_MAX 255                         // Tool power of a planner block at 100%
+
 
 void tool_init();                                // initialisation
 void tool_run(int8_t state, float pwr);          // run the tool from the tasklevel (stores current state)
@@ -11,11 +13,13 @@ void tool_run(int8_t state, float pwr);          // run the tool from the taskle
                                                  //         3 = M3 / On
                                                  //         4 = M4 / On
                                                  // pwr:    0...100 in %
-void tool_isr(int8_t state, float pwr);          // controll for the tool from isr level (stepper synced) 
+void tool_isr(int8_t state, uint8_t pwr);        // controll for the tool from isr level (stepper synced) 
                                                  // state:  5 = M5 / Off
                                                  //         3 = M3 / On
-                                                 //         4 = M4 / On
-                                                 // pwr:    0...100 in %
+                                                 //         4 = M4 / On, the stepper scales pwr to the step rate
+                                                 // pwr:    0...TOOL_PWR_MAX
 void tool_off();
+void tool_set_override(int16_t percent);         // tool power override in % (TOOL_OVERRIDE_MIN...TOOL_OVERRIDE_MAX),
+                                                 // applies at once to the tool state set by tool_isr()
 
 #endif